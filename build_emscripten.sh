@@ -1,10 +1,12 @@
 #!/bin/sh
 
 # my emscripten "build system"
-emcc src/r6502.cpp src/bus.cpp src/cartridge.cpp src/format.cpp src/main.cpp src/font.cpp src/ppu.cpp src/gfx.cpp \
+mkdir -p cmake-build-debug/generated
+cmake -DINPUT=monogram-bitmap.json -DOUTPUT=cmake-build-debug/generated/font_bitmap.h -P cmake/embed_font.cmake
+
+emcc src/r6502.cpp src/bus.cpp src/cartridge.cpp src/format.cpp src/main.cpp src/font.cpp src/ppu.cpp src/palette.cpp src/apu.cpp src/blip_buffer.cpp src/render_thread.cpp src/wav_writer.cpp src/frame_pacer.cpp src/save_state.cpp src/gfx.cpp src/audio_output.cpp src/emulation_thread.cpp src/panel.cpp src/rewind.cpp src/movie.cpp src/netplay.cpp src/timeline.cpp \
   -std=c++17 \
-  -Iinclude/ -I/opt/homebrew/include/ -include common.h \
-  --preload-file monogram-bitmap.json \
+  -Iinclude/ -Icmake-build-debug/generated/ -I/opt/homebrew/include/ -include common.h \
   --preload-file roms/ \
   -g -O2 \
   -s USE_SDL=2 \
@@ -0,0 +1,57 @@
+# Turns the font's JSON bitmap into a C++ header, so the font is compiled in rather than parsed at start-up.
+#
+#   cmake -DINPUT=monogram-bitmap.json -DOUTPUT=font_bitmap.h -P embed_font.cmake
+#
+# Text is drawn byte by byte, so only the single-byte (ASCII) characters are kept.
+
+file(READ ${INPUT} json)
+string(JSON count LENGTH "${json}")
+math(EXPR last "${count} - 1")
+
+foreach(i RANGE ${last})
+    string(JSON key MEMBER "${json}" ${i})
+    string(LENGTH "${key}" length)
+    if(NOT length EQUAL 1)
+        continue()
+    endif()
+    string(HEX "${key}" hex)
+    math(EXPR code "0x${hex}")
+    if(code GREATER_EQUAL 128)
+        continue()
+    endif()
+
+    set(rows "")
+    foreach(row RANGE 11)
+        string(JSON bits GET "${json}" "${key}" ${row})
+        list(APPEND rows ${bits})
+    endforeach()
+    list(JOIN rows ", " rows)
+    set(glyph_${code} "${rows}")
+endforeach()
+
+set(bitmap "")
+set(present "")
+foreach(code RANGE 127)
+    if(DEFINED glyph_${code})
+        string(APPEND bitmap "    {${glyph_${code}}}, // ${code}\n")
+        string(APPEND present "    true,  // ${code}\n")
+    else()
+        string(APPEND bitmap "    {}, // ${code}\n")
+        string(APPEND present "    false, // ${code}\n")
+    endif()
+endforeach()
+
+file(WRITE ${OUTPUT}.tmp "// generated from ${INPUT} by cmake/embed_font.cmake, do not edit
+#pragma once
+
+// each font character is 12 5-bit bitfields corresponding to whether or not each pixel in a row is set
+// (LSB is leftmost), indexed by character
+constexpr uint8 FONT_BITMAP[128][12] = {
+${bitmap}};
+
+constexpr bool FONT_HAS_GLYPH[128] = {
+${present}};
+")
+# only touch the header when it changed, so regenerating doesn't rebuild the font
+file(COPY_FILE ${OUTPUT}.tmp ${OUTPUT} ONLY_IF_DIFFERENT)
+file(REMOVE ${OUTPUT}.tmp)
@@ -0,0 +1,214 @@
+#pragma once
+
+#include <memory>
+
+#include "blip_buffer.h"
+
+#define CPU_CLOCK_RATE 1789773.0 // NTSC, in Hz
+
+class Bus;
+
+/// Everything the APU emulates, in one trivially copyable block for save states. Only the APU itself can touch it.
+class APUState {
+    friend class APU;
+
+    // https://www.nesdev.org/wiki/APU_Envelope
+    struct Envelope {
+        bool start = false;
+        bool loop = false; // also halts the channel's length counter
+        bool constant = false;
+        uint8 volume = 0; // the constant volume, or the decay rate
+        uint8 divider = 0;
+        uint8 decay = 0;
+
+        void clock();
+        uint8 output() const { return constant ? volume : decay; }
+    };
+
+    // https://www.nesdev.org/wiki/APU_Pulse
+    struct Pulse {
+        bool ones_complement_sweep; // only pulse 1
+        bool enabled = false;
+        uint8 duty = 0, step = 0;
+        uint16 period = 0, timer = 0; // in APU cycles (every other CPU cycle)
+        uint8 length = 0;
+        Envelope envelope;
+
+        bool sweep_enabled = false, sweep_negate = false, sweep_reload = false;
+        uint8 sweep_period = 0, sweep_shift = 0, sweep_divider = 0;
+        uint8 reserved = 0;
+
+        explicit Pulse(bool ones_complement_sweep) : ones_complement_sweep(ones_complement_sweep) {}
+
+        void write(int reg, uint8 data);
+        void clock_timer();
+        void skip(uint64 ticks);
+        void clock_length();
+        void clock_sweep();
+        int sweep_target() const;
+        bool audible() const { return length > 0 && period >= 8 && sweep_target() <= 0x7ff && envelope.output() > 0; }
+        uint8 output() const;
+    };
+
+    // https://www.nesdev.org/wiki/APU_Triangle
+    struct Triangle {
+        bool enabled = false;
+        bool control = false; // halts the length counter and keeps reloading the linear counter
+        bool linear_reload = false;
+        uint8 linear_reload_value = 0, linear = 0;
+        uint8 reserved = 0;
+        uint16 period = 0, timer = 0; // in CPU cycles
+        uint8 step = 0, length = 0;
+
+        void write(int reg, uint8 data);
+        void clock_timer();
+        void skip(uint64 cycles);
+        void clock_length();
+        void clock_linear();
+        bool stepping() const { return length > 0 && linear > 0 && period >= 2; }
+        uint8 output() const { return step < 16 ? 15 - step : step - 16; }
+    };
+
+    // https://www.nesdev.org/wiki/APU_Noise
+    struct Noise {
+        bool enabled = false;
+        bool mode = false; // short (93-step) sequence
+        uint16 period = 0, timer = 0; // in APU cycles
+        uint16 shift = 1;
+        uint8 length = 0;
+        Envelope envelope;
+        uint8 reserved = 0;
+
+        void write(int reg, uint8 data);
+        void clock_timer();
+        void clock_shift();
+        void skip(uint64 ticks);
+        void clock_length();
+        bool audible() const { return length > 0 && envelope.output() > 0; }
+        uint8 output() const { return (shift & 1) || length == 0 ? 0 : envelope.output(); }
+    };
+
+    // https://www.nesdev.org/wiki/APU_DMC
+    struct DMC {
+        bool irq_enabled = false, loop = false, irq = false;
+        uint8 reserved0 = 0;
+        uint16 rate = 428, timer = 0; // in CPU cycles
+        uint8 output_level = 0;
+        uint8 reserved1 = 0;
+
+        uint16 sample_addr = 0xc000, sample_length = 1;
+        uint16 current_addr = 0, bytes_remaining = 0;
+        uint8 sample_buffer = 0;
+        bool buffer_empty = true;
+
+        uint8 shift = 0, bits_remaining = 8;
+        bool silence = true;
+        uint8 reserved2 = 0;
+
+        void write(int reg, uint8 data);
+        void clock_output();
+        void restart() { current_addr = sample_addr; bytes_remaining = sample_length; }
+        uint8 output() const { return output_level; }
+    };
+
+    Pulse pulse[2] = {Pulse(true), Pulse(false)};
+    Triangle triangle;
+    Noise noise;
+    DMC dmc;
+
+    // https://www.nesdev.org/wiki/APU_Frame_Counter
+    bool five_step = false;
+    bool irq_inhibit = false;
+    bool frame_irq = false;
+    uint8 reserved0 = 0;
+    uint32 frame_counter_cycle = 0;
+
+    uint64 cycles = 0;        // CPU cycles the APU has been clocked for; pulse and noise timers tick on the odd ones
+    uint64 synced_cycles = 0; // how many of them the channels have actually been run for
+    uint64 next_sync = 0;     // the cycle an IRQ or a DMC fetch can next happen on, which can't wait for a catch-up
+    bool mix_changed = false; // a register write may have changed the output, which has to be mixed on the next cycle
+    uint8 reserved1[7] = {};
+};
+
+/// The 2A03's audio processing unit. See https://www.nesdev.org/wiki/APU
+///
+/// Clocked once per CPU cycle, but the channels are only run when something can observe them: a register access, an
+/// IRQ or DMC fetch coming due, or samples being read. Catching up skips straight over cycles where no channel's output
+/// can change, then steps the ones where it does exactly as clocking every cycle would, so the result is identical.
+///
+/// Instead of sampling the channels at the CPU's rate, every change in the mixed output is handed to a BlipBuffer,
+/// which produces samples at the host's rate.
+class APU : public APUState {
+    Bus &bus;
+
+    std::unique_ptr<BlipBuffer> blip;
+    int sample_rate = 0;
+    double rate_adjustment = 1.0;
+    uint32 blip_clock = 0; // CPU cycles since the blip buffer's frame began
+    int amplitude = 0;     // the last mixed output given to the blip buffer
+    bool muted = false;
+    bool reference = false; // see set_reference_mode
+
+    void clock_frame_counter();
+    void clock_quarter_frame();
+    void clock_half_frame();
+    void clock_dmc();
+    uint32 next_frame_counter_step() const;
+    uint64 next_dmc_fetch() const;
+    uint64 next_event() const;
+    void step();
+    void skip(uint64 count);
+    void catch_up();
+    void schedule_sync();
+    int mix() const;
+    void end_audio_frame();
+
+public:
+    explicit APU(Bus &bus) : bus(bus) {}
+
+    void cpu_write(uint16 addr, uint8 data);
+    uint8 cpu_read(uint16 addr);
+
+    /// Silences every channel, like writing 0 to $4015.
+    void reset();
+
+    /// Restores state saved from another APU. Samples produced already are kept; the output moves to the restored
+    /// channels' level from the next cycle on.
+    void load_state(const APUState &state);
+
+    /// Runs the channels up to the current cycle. How far behind they lag otherwise depends on how often they're
+    /// observed (e.g. whether samples are read), so states are only comparable after this.
+    void sync() { catch_up(); }
+
+    /// The frame counter or the DMC is asserting the CPU's IRQ line.
+    bool irq_pending() const { return frame_irq || dmc.irq; }
+
+    /// Sets the rate samples are produced at. 0, the default, skips synthesis altogether, e.g. when running headless.
+    void set_sample_rate(int rate, BlipBuffer::Quality quality = BlipBuffer::Quality::Medium);
+    /// Produces `ratio` times as many samples per emulated second, from the next batch of samples on. Used to keep an
+    /// audio device's queue from slowly draining or filling when the emulation and device clocks drift apart.
+    void set_rate_adjustment(double ratio) {
+        catch_up();
+        rate_adjustment = ratio;
+    }
+    /// While muted the channels run as usual but nothing reaches the blip buffer, so frames that are only emulated to
+    /// be thrown away again (e.g. by run-ahead) leave the audio exactly where it was.
+    void set_muted(bool mute) {
+        catch_up();
+        muted = mute;
+    }
+    /// Catches up by stepping the channels through every cycle, without skipping over any: the slow way that has to
+    /// produce exactly the same state and samples. For tests.
+    void set_reference_mode(bool on) {
+        catch_up();
+        reference = on;
+    }
+    int samples_available();
+    /// Reads (and removes) up to `count` mono samples. Returns how many were read.
+    int read_samples(int16 *out, int count);
+
+    void clock() {
+        if (++cycles > next_sync)
+            catch_up();
+    }
+};
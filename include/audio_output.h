@@ -0,0 +1,50 @@
+#pragma once
+
+#include <SDL2/SDL.h>
+
+#include <atomic>
+
+#include "ring_buffer.h"
+
+/// Plays mono samples through SDL's audio callback.
+///
+/// The emulation side pushes into a lock-free ring and the callback pops from it, so neither ever waits for the other:
+/// a full ring drops the newest samples and an empty one plays silence. rate_adjustment() reports how much faster or
+/// slower samples should be produced to keep the ring half full, which absorbs the drift between the emulator's
+/// and the sound card's clocks without audible pitch changes.
+class AudioOutput {
+    static constexpr size_t RING_CAPACITY = 4096; // samples, about 85 ms at 48 kHz
+    static constexpr double MAX_RATE_ADJUSTMENT = 0.005;
+
+    SDL_AudioDeviceID device = 0;
+    RingBuffer<int16> ring;
+
+    static void callback(void *userdata, Uint8 *stream, int len);
+
+public:
+    int sample_rate = 0; // what the device actually opened with, 0 if it couldn't be opened
+
+    std::atomic<uint64> underruns = 0;      // callbacks that ran out of samples
+    std::atomic<uint64> samples_played = 0; // including the silence played on underruns
+    uint64 overruns = 0;                    // pushes that didn't fit
+
+    explicit AudioOutput(int requested_rate);
+    ~AudioOutput();
+
+    AudioOutput(const AudioOutput &) = delete;
+    AudioOutput &operator=(const AudioOutput &) = delete;
+
+    bool is_open() const { return device != 0; }
+
+    /// Never blocks; whatever doesn't fit is dropped.
+    void push(const int16 *samples, int count);
+
+    /// The device's own clock: how much it has played so far. Advances in steps of a whole callback's worth.
+    double played_seconds() const { return sample_rate ? static_cast<double>(samples_played) / sample_rate : 0; }
+
+    /// How full the ring is, from 0 to 1.
+    double fill() const { return static_cast<double>(ring.size()) / ring.capacity(); }
+
+    /// Ratio to produce samples at, within 1 +/- MAX_RATE_ADJUSTMENT: above 1 while the ring is less than half full.
+    double rate_adjustment() const { return 1.0 + MAX_RATE_ADJUSTMENT * (1.0 - 2.0 * fill()); }
+};
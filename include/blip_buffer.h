@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstring>
+#include <vector>
+
+/// Turns a signal given as amplitude changes at clock times into samples at a much lower rate, without aliasing.
+///
+/// Each change is added as a band-limited step (a windowed sinc impulse placed at the change's fractional sample
+/// position, integrated when the samples are read), so the cost is per change rather than per clock.
+/// The impulses are the phases of a polyphase FIR filter, so resampling to any output rate (44.1, 48, 96 kHz...) costs
+/// the same, and the quality preset picks how many taps they have.
+/// In the spirit of Shay Green's blip_buf, see http://slack.net/~ant/libs/audio.html#Blip_Buffer
+class BlipBuffer {
+public:
+    static constexpr int PHASE_BITS = 5;
+    static constexpr int PHASES = 1 << PHASE_BITS; // sub-sample positions an impulse can start at
+
+    enum class Quality {
+        Low,    // 8 taps, the top few kHz roll off
+        Medium, // 16 taps
+        High,   // 32 taps, flat to close to the output's Nyquist frequency
+    };
+
+private:
+    static constexpr int DELTA_BITS = 15; // fixed point precision of the kernel
+    static constexpr int BASS_SHIFT = 9;  // high-pass to remove DC, roughly like the NES's own output filter
+
+    // taps are added this many at a time; every kernel width is a multiple of it
+    static constexpr int LANES = 8;
+    typedef int32 Lanes __attribute__((vector_size(LANES * sizeof(int32))));
+
+    uint64 factor = 0; // samples per clock, in 32.32 fixed point
+    uint64 offset = 0; // sample position of clock 0 of the current frame, in 32.32 fixed point
+    std::vector<int32> buffer;
+    int32 integrator = 0;
+    int kernel_width;          // samples each impulse is spread over
+    std::vector<int32> kernel; // PHASES rows of kernel_width taps
+
+public:
+    /// @param max_samples how many samples can be buffered before they have to be read
+    BlipBuffer(double clock_rate, double sample_rate, int max_samples, Quality quality = Quality::Medium);
+
+    /// Can be called between frames to nudge the rate, e.g. to keep an audio device's queue at a steady length.
+    void set_rates(double clock_rate, double sample_rate);
+
+    /// Adds a change in amplitude at `time` clocks since the start of the current frame.
+    void add_delta(uint32 time, int delta) {
+        uint64 fixed = offset + time * factor;
+        int32 *out = &buffer[fixed >> 32];
+        const int32 *k = &kernel[((fixed >> (32 - PHASE_BITS)) & (PHASES - 1)) * kernel_width];
+
+        // the output isn't aligned to anything, the copies become unaligned vector loads and stores
+        Lanes scale = Lanes{} + delta;
+        for (int i = 0; i < kernel_width; i += LANES) {
+            Lanes sum, taps;
+            std::memcpy(&sum, out + i, sizeof(Lanes));
+            std::memcpy(&taps, k + i, sizeof(Lanes));
+            sum += taps * scale;
+            std::memcpy(out + i, &sum, sizeof(Lanes));
+        }
+    }
+
+    /// Ends the current frame after `duration` clocks, making the samples before its end readable.
+    void end_frame(uint32 duration);
+
+    /// Clocks that can still be added to the current frame before the buffer is full.
+    uint32 clocks_until_full() const;
+
+    int samples_available() const { return static_cast<int>(offset >> 32); }
+    int capacity() const { return static_cast<int>(buffer.size()) - kernel_width; }
+
+    /// Reads (and removes) up to `count` samples. Returns how many were read.
+    int read_samples(int16 *out, int count);
+
+    void clear();
+};
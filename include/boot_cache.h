@@ -0,0 +1,22 @@
+#pragma once
+
+#include "bus.h"
+
+/// States of ROMs some frames after power-on with no buttons down, for instances that only live a short while, like
+/// analysis jobs: games spend their first few hundred frames clearing RAM and waiting for the PPU to warm up, which
+/// comes out the same every time.
+///
+/// Each snapshot is a save state file in the cache directory, named after the ROM hash, the frame count and the
+/// emulator's version, so a build that emulates differently never picks up another build's snapshots.
+namespace boot_cache {
+    /// Bump whenever a change to the emulation can change where a ROM ends up, even if MachineState's layout (and so
+    /// MachineState::VERSION) stays the same, e.g. a timing fix.
+    constexpr uint32 VERSION = 1;
+
+    /// Puts the bus at `frames` frames after power-on, from the snapshot in `directory` if there is one, otherwise
+    /// by emulating them and saving a snapshot there. Either way it ends up in exactly the same state, with nothing
+    /// to hear from the frames skipped. A RenderThread attached has to be recreated afterwards.
+    /// @param directory has to exist already
+    /// @return whether the snapshot came from the cache
+    bool boot(Bus &bus, const char *directory, int frames);
+}
@@ -1,9 +1,11 @@
 #pragma once
 
-#include <vector>
+#include <array>
+#include <type_traits>
 
 #include "r6502.h"
 #include "ppu.h"
+#include "apu.h"
 #include "cartridge.h"
 
 #define RAM_START 0
@@ -12,30 +14,68 @@
 #define PPU_START 0x2000
 #define PPU_END   0x3FFF
 
+#define APU_START 0x4000
+#define APU_END   0x4013
+
+#define OAM_DMA 0x4014
+#define APU_STATUS 0x4015
+#define APU_FRAME_COUNTER 0x4017
+
 #define CONTROLLER_START 0x4016
 #define CONTROLLER_END   0x4017
 
-class Bus {
+/// The bus's own part of a save state.
+struct BusState {
+    uint64 system_clock = 0;
+    uint16 dma_cycles = 0; // cpu cycles left where the cpu is suspended by an OAM DMA
+
+    std::array<uint8, 2 * 1024> ram = {};
+
+    uint8 controller_saved_state[2] = {};
+    uint8 reserved[4] = {};
+};
+
+/// The whole emulated machine at one point in time, as one trivially copyable block: taking or restoring a snapshot
+/// is a memcpy per component, and snapshots can be copied, compared, hashed and written out as plain bytes. None of
+/// the parts has any padding, which would hold whatever happened to be in memory: where alignment needs some, it's
+/// spelled out as a `reserved` field that stays zero, so the same machine is always the same bytes. The cartridge's
+/// PRG and CHR aren't part of it, only which of their banks are mapped: both are ROM, and writes to them are ignored,
+/// so they can't change while a game runs. A mapper with PRG or CHR RAM would have to add a block for it here.
+struct MachineState {
+    static constexpr uint32 VERSION = 2; // bump whenever the layout of any part changes
+
+    BusState bus;
+    R6502State cpu;
+    Mirroring mirroring;
+    PPUState ppu;
+    APUState apu;
+    uint8 mapper[Mapper::STATE_SIZE];
+};
+
+static_assert(std::is_trivially_copyable_v<MachineState>, "save states are copied as bytes");
+static_assert(std::has_unique_object_representations_v<MachineState>, "save states are compared and hashed as bytes");
+
+class Bus : public BusState {
 public:
     Cartridge cartridge;
     R6502 cpu;
     PPU ppu;
-
-    uint64 system_clock = 0;
-
-    std::vector<uint8> ram;
+    APU apu;
 
     uint8 controller[2] = {};
-    uint8 controller_saved_state[2] = {};
 
     bool breakpoints_enabled = false;
+    /// While set, enabled breakpoints don't stop anything, they only note the clock they were reached on in
+    /// last_breakpoint_clock. That's how history is searched for them.
+    bool probing_breakpoints = false;
+    uint64 last_breakpoint_clock = UINT64_MAX;
 
     explicit Bus(const char *file) : Bus(Cartridge::load_cartridge(file)) {}
 
     explicit Bus(Cartridge &&cartridge)
         : cartridge(std::move(cartridge))
-        , ram(2 * 1024)
         , ppu(*this, &this->cartridge)
+        , apu(*this)
     {}
 
     ~Bus() = default;
@@ -46,8 +86,59 @@ public:
     void write(uint16 addr, uint8 data);
     uint8 read(uint16 addr);
 
+    /// Called wherever an enabled breakpoint is reached. Throws BreakpointException, unless probing.
+    void hit_breakpoint();
+
     void clock();
     void execute_one_instruction();
     void execute_one_frame();
     void reset();
+
+    /// Copies the machine's state out. Must be called between clocks, not from a breakpoint.
+    void save_state(MachineState &state) const;
+    /// Restores a state saved from a bus with the same ROM. A RenderThread attached has to be resynced afterwards.
+    void load_state(const MachineState &state);
+
+    /// A new bus in the same state that goes on independently, e.g. to try different inputs from here. Takes a few
+    /// microseconds: the ROM is shared until one of them writes to it, and the rest is a MachineState. It gets the
+    /// same controllers and render interval, but no breakpoints, audio or render thread. Only between clocks, from
+    /// the thread running this bus.
+    std::unique_ptr<Bus> fork() const;
+    /// Like fork(), but the new bus starts from `state`, saved from a bus with the same ROM, instead of this one's.
+    std::unique_ptr<Bus> fork(const MachineState &state) const;
+
+    /// Hashes the whole MachineState, e.g. to check that two runs ended up in the same place. The APU is caught up
+    /// first, so it doesn't matter how often it happened to be observed on the way.
+    uint64 state_hash();
+};
+
+/// Makes a bus run silently, without drawing and without stopping on breakpoints, for as long as it's in scope, e.g.
+/// to run frames again that were already seen and heard. Everything is put back as it was when it goes out of scope.
+/// Muting first has the APU catch up, so the cycles already due are heard once, not again after a state is loaded.
+class ReplaySettings {
+    Bus &bus;
+    int render_interval;
+    bool breakpoints_enabled, probing_breakpoints;
+
+public:
+    explicit ReplaySettings(Bus &bus)
+        : bus(bus)
+        , render_interval(bus.ppu.render_interval)
+        , breakpoints_enabled(bus.breakpoints_enabled)
+        , probing_breakpoints(bus.probing_breakpoints)
+    {
+        bus.apu.set_muted(true);
+        bus.ppu.render_interval = 0;
+        bus.breakpoints_enabled = false;
+    }
+
+    ~ReplaySettings() {
+        bus.apu.set_muted(false);
+        bus.ppu.render_interval = render_interval;
+        bus.breakpoints_enabled = breakpoints_enabled;
+        bus.probing_breakpoints = probing_breakpoints;
+    }
+
+    ReplaySettings(const ReplaySettings &) = delete;
+    ReplaySettings &operator=(const ReplaySettings &) = delete;
 };
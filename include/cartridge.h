@@ -1,21 +1,50 @@
 #pragma once
 
+#include <atomic>
 #include <string_view>
 #include <vector>
 
 #include "mapper.h"
 
-enum class Mirroring {
-    Horizontal,
-    Vertical
+/// Bytes shared by copies until one of them writes: every clone of a cartridge reads the same ROM, and only one that
+/// is written to (e.g. while it's loaded) pays for a copy of its own. Copies may be used from different threads.
+class SharedBytes {
+    std::shared_ptr<std::vector<uint8>> bytes;
+
+    void unshare() {
+        if (bytes.use_count() > 1)
+            bytes = std::make_shared<std::vector<uint8>>(*bytes);
+        else
+            std::atomic_thread_fence(std::memory_order_acquire); // after whoever else had it was done reading
+    }
+
+public:
+    explicit SharedBytes(size_t size) : bytes(std::make_shared<std::vector<uint8>>(size)) {}
+
+    size_t size() const { return bytes->size(); }
+    const uint8 *data() const { return bytes->data(); }
+    uint8 operator[](size_t i) const { return (*bytes)[i]; }
+
+    /// These make a copy of its own first if it's shared, so they're only for writing.
+    uint8 *data() { unshare(); return bytes->data(); }
+    uint8 &operator[](size_t i) { unshare(); return (*bytes)[i]; }
 };
 
 class Cartridge {
     int num_prg_banks, num_chr_banks;
     std::unique_ptr<Mapper> mapper;
 
+    Cartridge(const Cartridge &other, std::unique_ptr<Mapper> &&mapper)
+        : num_prg_banks(other.num_prg_banks)
+        , num_chr_banks(other.num_chr_banks)
+        , mapper(std::move(mapper))
+        , prg(other.prg)
+        , chr(other.chr)
+        , mirroring(other.mirroring)
+    {}
+
 public:
-    std::vector<uint8> prg, chr;
+    SharedBytes prg, chr;
 
     Mirroring mirroring = Mirroring::Horizontal;
 
@@ -29,9 +58,21 @@ public:
 
     static Cartridge load_cartridge(const char *file);
 
+    /// A copy that runs independently, including the mapper's state. The ROM is shared until either one writes to it.
+    Cartridge clone() const;
+
     std::optional<uint8> cpu_read(uint16 addr);
     bool cpu_write(uint16 addr, uint8 val);
     std::optional<uint8> ppu_read(uint16 addr);
     bool ppu_write(uint16 addr, uint8 val);
 
+    void clock_scanline() { mapper->clock_scanline(); }
+
+    /// The mapper's registers, Mapper::STATE_SIZE bytes. Mirroring is kept separately.
+    void save_state(uint8 *mapper_state) const { mapper->save_state(mapper_state); }
+    void load_state(const uint8 *mapper_state) { mapper->load_state(mapper_state); }
+
+    /// Identifies the ROM, to tell which save states belong to it.
+    uint64 rom_hash() const;
+
 };
\ No newline at end of file
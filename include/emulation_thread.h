@@ -0,0 +1,171 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "bus.h"
+#include "audio_output.h"
+#include "frame_pacer.h"
+#include "movie.h"
+#include "netplay.h"
+#include "render_thread.h"
+#include "rewind.h"
+#include "save_state.h"
+#include "ring_buffer.h"
+#include "timeline.h"
+#include "triple_buffer.h"
+#include "wav_writer.h"
+
+/// Everything the debugger UI shows of the emulator, copied out of the bus after every frame by the thread running it.
+struct EmulatorSnapshot {
+    uint64 sequence = 0; // counts up with every snapshot published, so the UI can skip the ones it has already drawn
+
+    std::vector<uint8> frame; // SCREEN_WIDTH * SCREEN_HEIGHT indices into palette_array, empty until one is drawn
+
+    uint8 a = 0, x = 0, y = 0, sp = 0, status = 0;
+    uint16 pc = 0;
+    uint8 cycles = 0;
+    uint16 vram_addr = 0;
+    uint8 ppu_data = 0;
+
+    uint8 palettes[32] = {};    // with the mirrored backdrop entries resolved
+    uint8 nametable[1024] = {}; // the first one
+    uint8 pattern_tables[0x2000] = {};
+
+    RenderStats render_stats;
+    FramePacer::Stats pacing = {};
+    bool running = false;
+    bool breakpoints_enabled = false;
+    bool render_thread = false;
+    bool capturing = false;
+    bool recording_movie = false;
+    bool playing_movie = false;
+    bool netplay = false;
+    Rollback::Stats netplay_stats;
+    Rewind::Stats rewind;
+    int run_ahead = 0;
+    double run_ahead_ms = 0; // host time the run-ahead frames take per update, smoothed
+};
+
+/// Runs a bus on its own thread, paced to the NES's frame rate, so the debugger UI's cost never comes out of
+/// emulation time.
+///
+/// The UI only talks to it through lock-free structures: commands go in through a ring, controller state through an
+/// atomic, and every frame comes back as an EmulatorSnapshot through a triple buffer, so neither side ever waits for
+/// the other. The thread also owns everything else that touches the bus while it runs: the audio output's producer
+/// side, audio capture, the render thread, the rewind history, which gets a state before every frame, the timeline
+/// the debugger steps back through, and movies.
+///
+/// Controller input is latched once per frame, from a movie while one plays back. Anything that moves the machine
+/// somewhere a movie can't follow (a reset, loading a state, rewinding, stepping back) stops the movie.
+class EmulationThread {
+public:
+    enum class Command {
+        Clock, // only while stopped
+        Step,  // only while stopped
+        Frame, // only while stopped
+        StepBack,     // only while stopped
+        ContinueBack, // only while stopped, to the last breakpoint before
+        Reset,
+        ToggleRunning,
+        ToggleBreakpoints,
+        ToggleRenderThread,
+        ToggleCapture,
+        SaveState,
+        LoadState,
+        ToggleRecording, // restarts from power-on
+        TogglePlayback,  // restarts from power-on
+    };
+
+private:
+    static constexpr size_t COMMAND_CAPACITY = 64;
+    static constexpr size_t REWIND_BUDGET = 4 << 20; // bytes, about a minute of most games
+    static constexpr uint64 TIMELINE_KEYFRAME_INTERVAL = 5 * 341 * 262; // PPU clocks, about 5 frames
+    static constexpr size_t TIMELINE_KEYFRAMES = 120; // 10 s of history in under 1 MB
+
+    Bus &bus;
+    AudioOutput &audio;
+    std::unique_ptr<RenderThread> render_thread;
+    std::unique_ptr<WavWriter> capture; // only while recording
+    Rewind rewind;
+    Timeline timeline;
+    std::unique_ptr<MachineState> rewind_state; // kept around, to not allocate a state every frame
+    std::unique_ptr<MachineState> run_ahead_state;
+    std::unique_ptr<MachineState> power_on_state; // where movies start from
+    std::unique_ptr<Movie> recording; // only while recording
+    std::unique_ptr<Movie> playback;  // only while playing back
+    size_t playback_frame = 0;
+    std::unique_ptr<Transport> netplay_transport;
+    std::unique_ptr<Rollback> netplay; // only during a netplay session
+    FramePacer pacer;
+
+    bool running = false; // emulating at full speed, as opposed to stopped for stepping
+    bool breakpoints_enabled = false;
+    uint64 snapshots_published = 0;
+    bool rewound_last_update = false; // so rewinding stops the movie and clears the timeline only when it starts
+    bool ran_ahead = false; // this update's picture is a run-ahead frame's, drawn here rather than by the render thread
+    double run_ahead_ms = 0;
+
+    RingBuffer<Command> commands;
+    TripleBuffer<EmulatorSnapshot> snapshots;
+
+    std::atomic<bool> alive = true;
+    std::thread worker;
+
+    void run();
+    void execute(Command command);
+    void toggle_capture();
+    void save_state();
+    void load_state();
+    /// Loads a state neither the movie nor the timeline leads to, so both are dropped.
+    void restore(const MachineState &state);
+    /// Loads a state and brings the render thread along, leaving the movie and timeline to the caller.
+    void load(const MachineState &state);
+    void step_back(Command command);
+    void toggle_recording();
+    void toggle_playback();
+    void stop_movie();
+    void feed_input();
+    /// @param draw whether the last of the frames is drawn, the others never are
+    void run_frames(int count, bool draw);
+    void rewind_frame();
+    void run_ahead_frames(int count);
+    void publish_snapshot();
+
+public:
+    static constexpr int MAX_RUN_AHEAD = 4;
+
+    std::atomic<uint16> input = 0; // controller 1 in the low byte, controller 2 in the high byte
+    std::atomic<bool> fast_forward = false;
+    std::atomic<bool> rewinding = false; // steps back a frame per update instead of emulating, while running
+    /// Frames emulated past the real one with the current input, whose picture is shown instead, after which the
+    /// real frame's state is restored. Hides that many frames of a game's own input lag. 0 is off.
+    std::atomic<int> run_ahead = 0;
+
+    /// The bus has to be reset already, and neither it nor `audio` may be touched by anyone else from here on.
+    EmulationThread(Bus &bus, AudioOutput &audio);
+    ~EmulationThread();
+
+    EmulationThread(const EmulationThread &) = delete;
+    EmulationThread &operator=(const EmulationThread &) = delete;
+
+    /// Starts running update() on the thread, once per frame.
+    void start();
+
+    /// Restarts from power-on as one side of a rollback session, running. Anything else that would change the
+    /// machine (reset, loading states, movies, stepping, the render thread) is refused from then on, since the peer
+    /// can't follow it. Only before start().
+    void start_netplay(std::unique_ptr<Transport> transport, int player, int input_delay);
+
+    /// Runs queued commands, emulates a frame if running, and publishes a snapshot. Called by the thread, or
+    /// directly on platforms without threads.
+    void update();
+
+    /// Never blocks; dropped (with a warning) if the thread is that far behind.
+    void send(Command command);
+
+    /// The newest snapshot. Only for the one UI thread, valid until the next call.
+    const EmulatorSnapshot &latest_snapshot();
+};
@@ -2,10 +2,8 @@
 
 #include <SDL2/SDL.h>
 
-#include <map>
-#include <array>
-#include <string>
 #include <string_view>
+#include <vector>
 
 class Font {
 public:
@@ -18,14 +16,28 @@ public:
     static constexpr int TEXT_ROWS = 12;
 
 private:
-    // each font character is 12 5-bit bitfields corresponding to whether or not each pixel in a row is set
-    // (LSB is leftmost)
-    std::map<std::string, std::array<uint8, TEXT_ROWS>> characters;
+    static constexpr int GLYPHS = 128; // text is drawn byte by byte, so only ASCII can be drawn anyway
+
+    /// Every glyph already drawn in one colour, at one scale, in one pixel format, so drawing text is only copying
+    /// spans of pixels out of it.
+    struct Atlas {
+        uint32 format;
+        uint32 pixel;
+        int scale;
+        std::vector<uint32> pixels; // TEXT_ROWS * scale rows of TEXT_COLS * scale pixels for every glyph, one after the other
+    };
+
+    // built the first time a colour and scale are drawn, never freed; only a few are ever used
+    mutable std::vector<Atlas> atlases;
+
+    const Atlas &atlas_for(const SDL_PixelFormat *format, SDL_Color color, int scale) const;
 
 public:
+    /// The monogram font, compiled in from monogram-bitmap.json.
     Font() = default;
-    explicit Font(const char *bitmap_json);
 
     SDL_Surface *render_text(std::string_view text, SDL_Color color, int scale = 2) const;
+
+    /// Only pixels of the glyphs are drawn, so text can overlap. Not thread safe: it may build an atlas.
     void render_to_surface(SDL_Surface *surface, int x, int y, std::string_view text, SDL_Color color, int scale = 2) const;
-};
\ No newline at end of file
+};
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "bus.h"
+
+/// Runs many buses forward at once on a fixed set of threads: for planners that explore a game's futures by forking
+/// a bus (see Bus::fork) and trying different inputs on each fork.
+class ForkPool {
+public:
+    struct Job {
+        Bus *bus;
+        std::vector<uint16> input; // a frame each, controller 1 in the low byte, controller 2 in the high byte
+
+        // where the bus ended up, filled in by run()
+        uint64 picture_hash = 0; // of the last frame drawn, 0 if the bus never drew one
+        uint64 state_hash = 0;   // Bus::state_hash
+        std::array<uint8, 2 * 1024> ram = {};
+    };
+
+private:
+    std::vector<std::thread> workers;
+    std::mutex lock;
+    std::condition_variable work_ready, work_done;
+    bool stopping = false;
+    uint64 generation = 0; // counts up with every run, so workers can tell there's new work
+
+    std::vector<Job> *jobs = nullptr; // only while a run is going on
+    std::atomic<size_t> next_job = 0;
+    size_t jobs_finished = 0;
+    int workers_busy = 0; // the jobs can't go away while a worker may still look at them
+
+    void work();
+    /// Takes jobs until there are none left. Returns how many it did.
+    size_t take_jobs(std::vector<Job> &to_run);
+
+public:
+    /// @param threads 0 for one per hardware thread. The thread calling run() takes jobs too.
+    explicit ForkPool(int threads = 0);
+    ~ForkPool();
+
+    ForkPool(const ForkPool &) = delete;
+    ForkPool &operator=(const ForkPool &) = delete;
+
+    int threads() const { return static_cast<int>(workers.size()) + 1; }
+
+    /// Runs every job's frames on its bus, and returns once all of them are done. A bus may only be in one job, and
+    /// nothing else may touch it meanwhile. Only from one thread at a time.
+    void run(std::vector<Job> &jobs);
+};
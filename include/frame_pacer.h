@@ -0,0 +1,73 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+
+#define NTSC_FRAME_RATE 60.0988 // CPU_CLOCK_RATE / 29780.5 cycles per frame, in Hz
+
+/// Keeps a loop running at the NES's frame rate without burning a core.
+///
+/// Waits by sleeping until shortly before the frame is due, then spinning (yielding) for the rest, so the wake-up is
+/// precise without spending more than a few hundred microseconds per frame awake. The spin margin adapts to how late
+/// the OS's sleeps turn out to be.
+///
+/// Optionally follows an external clock, e.g. the audio device's, so that video and audio can't drift apart. Such
+/// clocks usually only advance in buffer-sized steps, so rather than tracking it directly the pacer measures its rate
+/// against the wall clock over a long window and scales the frame period by that.
+class FramePacer {
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr auto MIN_SPIN = std::chrono::microseconds(200);
+    static constexpr auto MAX_SPIN = std::chrono::milliseconds(2);
+    static constexpr int MAX_LATE_FRAMES = 4;   // past this the pacer gives up catching up and starts over
+    static constexpr int JITTER_WINDOW = 120;   // frames the stats are taken over
+    static constexpr double MAX_DRIFT = 0.01;   // external clock rates further from the wall clock than this are ignored
+    static constexpr double DRIFT_WARMUP = 4;   // seconds an external clock is observed before it's trusted
+    static constexpr double DRIFT_WINDOW = 30;  // seconds, the rate is measured over between 1 and 2 of these
+
+    struct ClockPoint {
+        Clock::time_point wall;
+        double external;
+    };
+
+    double frame_rate;
+    Clock::time_point next_frame;
+    Clock::time_point last_frame;
+    Clock::duration spin = MIN_SPIN;
+    Clock::duration oversleep{}; // running average of how late sleeps wake up
+
+    std::function<double()> external_clock;
+    double clock_ratio = 1; // external seconds per wall clock second
+    bool have_reference = false;
+    ClockPoint reference, next_reference;
+
+    double intervals[JITTER_WINDOW] = {}; // ms between the last frames
+    int interval_count = 0, next_interval = 0;
+    uint64 late_frames = 0;
+
+    void update_clock_ratio(Clock::time_point now);
+    void record_interval(Clock::time_point now);
+
+public:
+    struct Stats {
+        double target_ms;
+        double mean_ms;
+        double jitter_ms; // standard deviation of the frame times
+        double worst_ms;  // furthest any frame time was from the target
+        uint64 late_frames;
+        double clock_ratio;
+    };
+
+    explicit FramePacer(double frame_rate = NTSC_FRAME_RATE) : frame_rate(frame_rate) {}
+
+    /// Follows `clock`, in seconds, instead of only the wall clock. nullptr goes back to the wall clock.
+    void set_external_clock(std::function<double()> clock);
+
+    /// Blocks until the next frame is due. The first call returns immediately.
+    void wait();
+
+    /// Starts over from the next wait(), e.g. after the loop was blocked for a while.
+    void reset();
+
+    Stats stats() const;
+};
@@ -3,6 +3,11 @@
 #include <SDL2/SDL.h>
 #include "font.h"
 #include "bus.h"
+#include "audio_output.h"
+#include "emulation_thread.h"
+#include "frame_pacer.h"
+#include "palette.h"
+#include "panel.h"
 
 constexpr SDL_Color white = {255, 255, 255, 255};
 constexpr SDL_Color red = {255, 127, 127, 255};
@@ -22,17 +27,41 @@ ScreenVisualization& operator++(ScreenVisualization &v) {
 class NesFrontend {
 public:
     SDL_Window *window;
-    SDL_Surface *window_surface;
-    SDL_Surface *selected_palette_surface;
+    SDL_Renderer *renderer;
+
+    // the game is streamed into its texture with every new snapshot; the debug views are only redrawn, from
+    // their surfaces, when what they show has changed
+    SDL_Texture *screen_texture;
+    SDL_Surface *nametable_surface;
+    SDL_Texture *nametable_texture;
+    SDL_Surface *pattern_table_surfaces[2] = {};
+    SDL_Texture *pattern_table_textures[2] = {};
+    SDL_Surface *palettes_surface;
+    SDL_Texture *palettes_texture;
+    Palette system_palette = palette_array; // unless replaced by PALETTE_FILE
+    std::array<uint32, 64> palette_rgb = packed_palette_array; // system_palette in gfx::PIXEL_FORMAT
+
+    // the debugger's text, each part redrawn only when the state it shows changes
+    std::unique_ptr<Panel> help_panel, registers_panel, stats_panel, disassembly_panel, redraws_panel;
+
+    // what the debug views currently show
+    uint64 drawn_sequence = 0;
+    bool debug_views_drawn = false;
+    bool nametable_drawn = false;
+    uint8 drawn_nametable[1024] = {};
+    uint8 drawn_pattern_tables[0x2000] = {};
+    uint8 drawn_palettes[32] = {};
+    int drawn_palette = 0;
 
     Font font;
 
     Bus bus;
+    std::unique_ptr<AudioOutput> audio;
+    std::unique_ptr<EmulationThread> emulation; // declared after bus and audio so it's stopped first
     std::map<uint16, std::string> disassembly;
+    FramePacer pacer; // of the UI, at the display's refresh rate
 
     uint64 last_time;
-    bool full_speed = false;
-    bool breakpoints_enabled = false;
     int frames = 0;
     float frame_time = 0;
     int current_palette = 0;
@@ -43,6 +72,12 @@ public:
 
     void init_cpu();
     bool update();
-    void render_text(int x, int y, std::string_view text, SDL_Color color = white) const;
-    void render_cpu();
+    void render_panels(const EmulatorSnapshot &snapshot);
+
+    void render_screen(const uint8 *frame);
+    void update_debug_views(const EmulatorSnapshot &snapshot);
+    void render_nametable(const EmulatorSnapshot &snapshot);
+    void render_pattern_table(const EmulatorSnapshot &snapshot, int table, uint8 palette);
+    void render_palettes(const EmulatorSnapshot &snapshot);
+    SDL_Color color_from_palette(const EmulatorSnapshot &snapshot, uint8 palette, uint8 pixel);
 };
\ No newline at end of file
@@ -3,7 +3,13 @@
 #include <SDL2/SDL.h>
 
 namespace gfx {
+    // surfaces and textures share a format, so surfaces can be uploaded as they are; 0xRRGGBB like RGB::packed
+    constexpr uint32 PIXEL_FORMAT = SDL_PIXELFORMAT_RGB888;
+
     SDL_Surface *create_surface(int w, int h);
     bool in_bounds(SDL_Surface *surface, int x, int y);
     void set_pixel(SDL_Surface *surface, int x, int y, SDL_Color color);
-}
\ No newline at end of file
+
+    SDL_Texture *create_texture(SDL_Renderer *renderer, int w, int h);
+    void upload(SDL_Texture *texture, SDL_Surface *surface);
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstddef>
+
+/// 64-bit FNV-1a, see http://www.isthe.com/chongo/tech/comp/fnv/. Hashes several buffers as one when each call is
+/// passed the previous result.
+inline uint64 fnv1a(const void *data, size_t size, uint64 hash = 0xcbf29ce484222325) {
+    auto bytes = static_cast<const uint8 *>(data);
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
@@ -1,15 +1,31 @@
 #pragma once
 
+#include <memory>
 #include <optional>
 
+// How the PPU's four logical nametables ($2000, $2400, $2800, $2C00) are backed by physical memory.
+// See https://www.nesdev.org/wiki/Mirroring#Nametable_Mirroring
+enum class Mirroring {
+    Horizontal,        // $2000 = $2400, $2800 = $2C00
+    Vertical,          // $2000 = $2800, $2400 = $2C00
+    SingleScreenLower, // all four use the first 1 KiB page
+    SingleScreenUpper, // all four use the second 1 KiB page
+    FourScreen,        // cartridge supplies an extra 2 KiB so every nametable is distinct
+};
+
 class Mapper {
 protected:
     int num_prg_banks, num_chr_banks;
 
 public:
+    static constexpr size_t STATE_SIZE = 64; // the most a mapper's registers may take up in a save state
+
     Mapper(int num_prg_banks, int num_chr_banks) : num_prg_banks(num_prg_banks), num_chr_banks(num_chr_banks) {}
     virtual ~Mapper() = default;
 
+    // A copy with the same bank and register state, for a cartridge that has to be driven independently.
+    virtual std::unique_ptr<Mapper> clone() const = 0;
+
     // The family of map_*_* functions map an address to a new index into the cartridge's prg and chr vectors.
     // Some addresses won't be mapped. E.g. 0x1000 points to the NES RAM, so we shouldn't touch it and mappers should
     // return an empty optional. Some addresses, however, such as 0x9000 are not mapped by the CPU and are then
@@ -19,12 +35,27 @@ public:
     virtual std::optional<uint32> map_cpu_write(uint16 addr) = 0;
     virtual std::optional<uint32> map_ppu_read(uint16 addr) = 0;
     virtual std::optional<uint32> map_ppu_write(uint16 addr) = 0;
+
+    // Mappers that can switch mirroring at runtime (e.g. MMC1) return their current arrangement here. An empty
+    // optional means the mirroring is hardwired and the one from the iNES header should be used.
+    virtual std::optional<Mirroring> mirroring() { return {}; }
+
+    // Called once per rendered scanline when the PPU's address line A12 rises (e.g. the MMC3 scanline counter).
+    // See https://www.nesdev.org/wiki/MMC3#IRQ_Specifics
+    virtual void clock_scanline() {}
+
+    // Copy the bank and register state into the STATE_SIZE bytes given and back, for save states. Mappers without
+    // registers have nothing to save.
+    virtual void save_state(uint8 *) const {}
+    virtual void load_state(const uint8 *) {}
 };
 
 class Mapper00NROM : public Mapper {
 public:
     Mapper00NROM(int num_prgs, int num_chrs) : Mapper(num_prgs, num_chrs) {}
 
+    std::unique_ptr<Mapper> clone() const override { return std::make_unique<Mapper00NROM>(*this); }
+
     std::optional<uint32> map_cpu_read(uint16 addr) override {
         if (addr >= 0x8000 && addr <= 0xffff) {
             return addr & (num_prg_banks > 1 ? 0x7fff : 0x3fff);
@@ -32,10 +63,8 @@ public:
         return {};
     }
 
-    std::optional<uint32> map_cpu_write(uint16 addr) override {
-        if (addr >= 0x8000 && addr <= 0xffff) {
-            return addr & (num_prg_banks > 1 ? 0x7fff : 0x3fff);
-        }
+    std::optional<uint32> map_cpu_write(uint16) override {
+        // there are no registers, and the prg is ROM
         return {};
     }
 
@@ -48,7 +77,7 @@ public:
         return {};
     }
 
-    std::optional<uint32> map_ppu_write(uint16 addr) override {
+    std::optional<uint32> map_ppu_write(uint16) override {
         // if the ppu is writing it must be to the pattern memory, but you can't write to that
         return {};
     }
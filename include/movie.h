@@ -0,0 +1,43 @@
+#pragma once
+
+#include <vector>
+
+/// Controller input for every frame of a run from power-on, so playing it back on the same ROM reproduces the run
+/// exactly.
+struct Movie {
+    uint64 rom_hash = 0;       // Cartridge::rom_hash of the ROM it was recorded on, 0 if unknown (e.g. imported)
+    std::vector<uint16> input; // one per frame: controller 1 in the low byte, controller 2 in the high byte
+};
+
+/// Movie files, in our own binary format or FCEUX's FM2 (https://fceux.com/web/help/fm2.html).
+///
+/// The binary format is a header followed by runs of frames with the same input: a run is 4 bytes however long the
+/// buttons stay down, so an hour of play usually fits in a few KB. FM2 is text with one line per frame, for
+/// exchanging movies with other emulators.
+namespace movie {
+    constexpr char MAGIC[4] = {'N', 'E', 'S', 'M'};
+    constexpr uint32 VERSION = 1;
+
+    struct FileHeader {
+        char magic[4];
+        uint32 version;
+        uint32 frames;
+        uint32 runs;
+        uint64 rom_hash;
+    };
+
+    struct Run {
+        uint16 input;
+        uint16 frames;
+    };
+
+    static_assert(sizeof(FileHeader) == 24 && sizeof(Run) == 4, "these are part of the file format");
+
+    bool write(const char *path, const Movie &movie);
+    bool read(const char *path, Movie &movie);
+
+    /// FM2 has no field for our ROM hash, and its MD5 checksum is written as zeros, which FCEUX warns about but plays.
+    bool write_fm2(const char *path, const Movie &movie, const char *rom_name);
+    /// Only the two standard controllers are read. Resets and other commands are dropped with a warning.
+    bool read_fm2(const char *path, Movie &movie);
+}
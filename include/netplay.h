@@ -0,0 +1,193 @@
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <random>
+#include <vector>
+
+#include "bus.h"
+
+/// Where a rollback session's packets go. Unreliable and unordered like UDP, and never blocks.
+class Transport {
+public:
+    virtual ~Transport() = default;
+
+    virtual void send(const uint8 *data, size_t size) = 0;
+    /// Returns the size of the next packet received, or 0 if there's none waiting.
+    virtual size_t receive(uint8 *data, size_t capacity) = 0;
+};
+
+/// A UDP socket talking to one peer.
+class UdpTransport : public Transport {
+    int socket_fd = -1;
+
+public:
+    /// Binds `local_port` on all interfaces and only exchanges packets with `peer_host`:`peer_port`.
+    UdpTransport(uint16 local_port, const char *peer_host, uint16 peer_port);
+    ~UdpTransport() override;
+
+    UdpTransport(const UdpTransport &) = delete;
+    UdpTransport &operator=(const UdpTransport &) = delete;
+
+    bool is_open() const { return socket_fd >= 0; }
+
+    void send(const uint8 *data, size_t size) override;
+    size_t receive(uint8 *data, size_t capacity) override;
+};
+
+/// Two endpoints connected in-process through a simulated network, to test sessions on one machine: every packet is
+/// delayed by the latency plus up to `jitter` (so they also arrive out of order), and a share of them is lost. Only
+/// for use from one thread.
+class LoopbackLink {
+    struct Packet {
+        double arrival;
+        std::vector<uint8> data;
+    };
+
+    class Endpoint : public Transport {
+        LoopbackLink &link;
+        int side;
+
+    public:
+        Endpoint(LoopbackLink &link, int side) : link(link), side(side) {}
+        void send(const uint8 *data, size_t size) override;
+        size_t receive(uint8 *data, size_t capacity) override;
+    };
+
+    double latency, jitter, loss;
+    std::mt19937 random;
+    std::deque<Packet> in_flight[2]; // towards each side
+    Endpoint endpoints[2];
+
+public:
+    /// Seconds, by default of the wall clock. Sessions tested faster than real time pass in their own.
+    std::function<double()> clock;
+
+    /// @param latency,jitter one way, in seconds
+    /// @param loss share of packets dropped, 0 to 1
+    LoopbackLink(double latency, double jitter, double loss, uint32 seed = 1);
+
+    LoopbackLink(const LoopbackLink &) = delete;
+    LoopbackLink &operator=(const LoopbackLink &) = delete;
+
+    Transport &endpoint(int side) { return endpoints[side]; }
+};
+
+/// GGPO-style rollback netplay for two players: see https://www.ggpo.net/.
+///
+/// Each side runs its own bus without waiting for the other. Frames whose remote input hasn't arrived yet are run
+/// with a prediction (the last input that did arrive) and a save state is taken before each of them. When the real
+/// input turns out different, the session loads the state from the first mispredicted frame and runs forward again
+/// to the present, with no video or audio. Inputs are sent redundantly until acknowledged, so lost packets cost
+/// nothing but a later correction.
+///
+/// Both sides start from power-on. Each packet also carries a checksum of the sender's newest fully confirmed
+/// state, which catches desyncs, and how far ahead of the other side it thinks it is, which the side that's ahead
+/// uses to wait a frame now and then instead of making the other one roll back all the time.
+class Rollback {
+public:
+    static constexpr int MAX_PREDICTION = 8; // frames run ahead of the peer's input before waiting for it
+
+    struct Stats {
+        uint64 frames = 0;             // emulated for the first time
+        uint64 rollbacks = 0;
+        uint64 resimulated_frames = 0; // emulated again after a misprediction
+        uint64 max_depth = 0;          // the most frames a rollback went back
+        uint64 waits = 0;              // frames not emulated, because of MAX_PREDICTION or to let the peer catch up
+        uint64 desyncs = 0;
+        double ping_ms = 0;            // round trip, smoothed
+    };
+
+private:
+    static constexpr uint32 HISTORY = 128; // frames of inputs and checksums kept, a power of two
+    static constexpr int MAX_PACKET_INPUTS = 64;
+    static constexpr int TIME_SYNC_INTERVAL = 10; // frames between waits to let the peer catch up
+    static constexpr uint32 MAGIC = 0x524e454e;   // "NENR"
+    static constexpr uint32 NO_ECHO = UINT32_MAX;
+
+    struct Packet {
+        uint32 magic;
+        uint32 frame;          // the sender's current frame
+        int32 advantage;       // how many frames the sender thinks it's ahead
+        uint32 ack;            // the sender has all our inputs for the frames before this
+        uint32 first_input;    // frame of inputs[0]
+        uint32 input_count;
+        uint32 checksum_frame; // the sender's newest fully confirmed frame
+        uint32 time_ms;        // when it was sent, by the sender's clock
+        uint32 echo_ms;        // the time_ms of the newest packet the sender got from us, or NO_ECHO
+        uint32 reserved = 0;
+        uint64 rom_hash;
+        uint64 checksum;       // of the state at the start of checksum_frame, if that isn't UINT32_MAX
+        uint8 inputs[MAX_PACKET_INPUTS];
+    };
+
+    Bus &bus;
+    Transport &transport;
+    int player; // 0 or 1, which controller port this side's input goes to
+    int input_delay;
+    uint64 rom_hash;
+
+    uint32 current_frame = 0;
+    uint32 local_count = 0;    // frames this side's input is known for
+    uint32 remote_count = 0;   // frames the peer's input has arrived for, all of them
+    uint32 peer_ack = 0;       // frames of our input the peer has
+    uint32 peer_frame = 0;
+    int32 peer_advantage = 0;
+    int frames_since_wait = 0;
+    uint32 echo_ms = NO_ECHO;
+    uint32 rollback_to = UINT32_MAX; // the first frame run with a wrong prediction
+    bool warned_rom = false, warned_desync = false;
+
+    uint8 local_inputs[HISTORY] = {};
+    uint8 remote_inputs[HISTORY] = {};
+    uint8 predicted[HISTORY] = {}; // the remote input each frame was last run with
+    struct Checksum {
+        uint32 frame = UINT32_MAX;
+        uint64 value = 0;
+    };
+    Checksum checksums[HISTORY];
+    Checksum peer_checksums[HISTORY];
+    Checksum latest_checksum;
+    uint32 next_checksum = 0; // the first frame whose checksum hasn't been taken yet
+
+    std::vector<MachineState> states; // at the start of each of the last frames
+
+    void receive();
+    void send();
+    void roll_back();
+    void run_frame();
+    uint8 remote_input(uint32 frame) const;
+    MachineState &state_at(uint32 frame) { return states[frame % states.size()]; }
+    void record_checksum();
+    void compare_checksum(uint32 frame);
+    uint32 now_ms() const;
+
+public:
+    Stats stats;
+    /// Seconds, by default of the wall clock, only used to measure the ping. Tests faster than real time pass in
+    /// their own.
+    std::function<double()> clock;
+
+    /// The bus has to be at power-on, and the peer's too.
+    /// @param input_delay frames local input is held back by, which trades some latency for fewer rollbacks
+    Rollback(Bus &bus, Transport &transport, int player, int input_delay = 0);
+
+    /// Exchanges packets, rolls back if a prediction turned out wrong, then emulates the next frame with `input` as
+    /// this side's controller. Returns false, without emulating, when it has to wait for the peer.
+    bool advance(uint8 input);
+
+    /// Only exchanges packets, e.g. while paused, so the peer isn't left waiting for acknowledgements.
+    void poll();
+
+    uint32 frame() const { return current_frame; }
+
+    /// Checksum of the state at the start of `frame`, once every input before it has arrived and while it's still in
+    /// the history. Compare with state_checksum on a bus that ran the same inputs.
+    std::optional<uint64> confirmed_checksum(uint32 frame) const;
+};
+
+/// What rollback sessions compare to detect a desync: RAM and the CPU. The rest of a state also depends on things
+/// like how frames were drawn, which differ between the two sides even when the games don't.
+uint64 state_checksum(const MachineState &state);
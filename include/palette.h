@@ -0,0 +1,95 @@
+#pragma once
+
+#include <array>
+#include <optional>
+
+struct RGB {
+    uint8 r, g, b;
+
+    /// As 0xRRGGBB, the layout of 32-bit RGB pixels.
+    constexpr uint32 packed() const { return r << 16 | g << 8 | b; }
+};
+
+using Palette = std::array<RGB, 64>;
+
+/// The colour of each of the 64 values the PPU can output. See https://www.nesdev.org/wiki/PPU_palettes
+inline constexpr Palette palette_array = {{
+        {117, 117, 117},
+        {39,  27, 143},
+        {0,   0, 171},
+        {71,   0, 159},
+        {143,   0, 119},
+        {171,   0,  19},
+        {167,   0,   0},
+        {127,  11,   0},
+        {67,  47,   0},
+        {0,  71,   0},
+        {0,  81,   0},
+        {0,  63,  23},
+        {27,  63,  95},
+        {0,   0,   0},
+        {0,   0,   0},
+        {0,   0,   0},
+        {188, 188, 188},
+        {0, 115, 239},
+        {35,  59, 239},
+        {131,   0, 243},
+        {191,   0, 191},
+        {231,   0,  91},
+        {219,  43,   0},
+        {203,  79,  15},
+        {139, 115,   0},
+        {0, 151,   0},
+        {0, 171,   0},
+        {0, 147,  59},
+        {0, 131, 139},
+        {0,   0,   0},
+        {0,   0,   0},
+        {0,   0,   0},
+        {255, 255, 255},
+        {63, 191, 255},
+        {95, 151, 255},
+        {167, 139, 253},
+        {247, 123, 255},
+        {255, 119, 183},
+        {255, 119,  99},
+        {255, 155,  59},
+        {243, 191,  63},
+        {131, 211,  19},
+        {79, 223,  75},
+        {88, 248, 152},
+        {0, 235, 219},
+        {0,   0,   0},
+        {0,   0,   0},
+        {0,   0,   0},
+        {255, 255, 255},
+        {171, 231, 255},
+        {199, 215, 255},
+        {215, 203, 255},
+        {255, 199, 255},
+        {255, 199, 219},
+        {255, 191, 179},
+        {255, 219, 171},
+        {255, 231, 163},
+        {227, 255, 163},
+        {171, 243, 191},
+        {179, 255, 207},
+        {159, 255, 243},
+        {0,   0,   0},
+        {0,   0,   0},
+        {0,   0,   0}
+}};
+
+/// Every colour of a palette packed (see RGB::packed), so turning a frame into pixels is one lookup per pixel.
+constexpr std::array<uint32, 64> pack_palette(const Palette &palette) {
+    std::array<uint32, 64> packed = {};
+    for (size_t i = 0; i < palette.size(); i++)
+        packed[i] = palette[i].packed();
+    return packed;
+}
+
+inline constexpr std::array<uint32, 64> packed_palette_array = pack_palette(palette_array);
+
+/// Reads a .pal file: 64 RGB triples, or 512 for files that include the colour emphasis variants, of which only the
+/// first 64 are used. Empty if the file doesn't exist or isn't a palette.
+std::optional<Palette> load_palette(const char *path);
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <SDL2/SDL.h>
+
+#include <cstring>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "font.h"
+
+/// A part of the debugger with its own surface and texture, redrawn only when the state it shows has changed.
+///
+/// Every frame the owner passes that state to changed(). Only if it differs from what was drawn last does the owner
+/// format and draw text again; otherwise the cached texture is presented as it is.
+class Panel {
+    SDL_Surface *surface;
+    SDL_Texture *texture;
+    const Font &font;
+
+    std::vector<uint8> state, drawn_state; // the raw bytes of the values passed to changed()
+    bool drawn = false;
+    bool dirty = false; // drawn into the surface since the last upload
+
+    template<typename T>
+    void append(const T &value) {
+        static_assert(std::is_trivially_copyable_v<T>, "panel state is compared bytewise");
+        size_t offset = state.size();
+        state.resize(offset + sizeof(T));
+        std::memcpy(state.data() + offset, &value, sizeof(T));
+    }
+
+public:
+    const SDL_Rect rect; // in window coordinates
+    uint64 redraws = 0;
+
+    Panel(SDL_Renderer *renderer, const Font &font, SDL_Rect rect);
+    ~Panel();
+
+    Panel(const Panel &) = delete;
+    Panel &operator=(const Panel &) = delete;
+
+    /// Whether the values differ from the ones the panel was last drawn with. If they do, the panel is cleared to be
+    /// drawn again. Structs are compared bytewise, so they must not have padding.
+    template<typename... T>
+    bool changed(const T &...values) {
+        state.clear();
+        (append(values), ...);
+        if (drawn && state == drawn_state)
+            return false;
+
+        std::swap(state, drawn_state);
+        drawn = true;
+        dirty = true;
+        redraws++;
+        SDL_FillRect(surface, nullptr, 0);
+        return true;
+    }
+
+    /// Draws text at a position in window coordinates.
+    void text(int x, int y, std::string_view text, SDL_Color color);
+
+    /// Uploads what was drawn since the last call, if anything, and copies the panel into the window.
+    void present(SDL_Renderer *renderer);
+};
@@ -1,6 +1,7 @@
 #pragma once
 
-#include <SDL2/SDL.h>
+#include <memory>
+
 #include "cartridge.h"
 
 #define PATTERN_START 0x0000
@@ -12,16 +13,59 @@
 #define PALETTE_START 0x3F00
 #define PALETTE_END   0x3FFF
 
+#define SCREEN_WIDTH  256
+#define SCREEN_HEIGHT 240
+
 class Bus;
+class RenderThread;
 
-class PPU {
-    Bus &bus;
-    Cartridge *cartridge;
+enum class RenderPath {
+    Fast,    // pixels are drawn in bulk, tile by tile, replaying the frame's register writes
+    Precise, // pixels are drawn by the dot-level background/sprite pipeline
+    Timing,  // no pixels are drawn, only the effects the CPU and mapper can observe are produced
+};
+
+/// A CPU write to a PPU register that happened while the PPU was rendering.
+struct FrameWrite {
+    int16 scanline;
+    int16 cycle;
+    uint8 reg;  // 0-7 for $2000-$2007
+    uint8 data;
+    bool simple; // the bulk renderer reproduces this write exactly (e.g. a sprite-0 scroll split)
+};
+
+/// An access that changes what the PPU draws, logged for a RenderThread to replay at the same dot.
+struct PPUEvent {
+    enum Kind : uint8 {
+        RegisterWrite,  // addr is 0-7 for $2000-$2007
+        RegisterRead,   // only the reads with side effects, $2002 and $2007
+        CartridgeWrite, // mapper registers, which can switch banks or mirroring
+        FrameEnd,       // every pixel of the previous frame has been output
+        Resync,         // the bus's state was replaced, see RenderThread::resync
+    };
+
+    uint64 dot; // PPU::dots at the time of the access
+    uint16 addr;
+    uint8 data;
+    Kind kind;
+};
+
+struct RenderStats {
+    uint64 fast_frames = 0;     // rendered entirely by the bulk renderer
+    uint64 precise_frames = 0;  // rendered entirely by the dot-level pipeline
+    uint64 fallback_frames = 0; // started in bulk, switched to the dot-level pipeline partway through
+    uint64 skipped_frames = 0;  // produced only timing, see PPU::render_interval
+};
+
+/// Everything the PPU emulates, in one trivially copyable block for save states. Only the PPU itself can touch the
+/// private parts.
+class PPUState {
+    friend class PPU;
 
     union {
         uint8 value = 0;
         struct {
-            uint8 :5, sprite_overflow:1, sprite_zero_hit:1, vertical_blank:1;
+            uint8 reserved:5, sprite_overflow:1, sprite_zero_hit:1, vertical_blank:1;
         };
     } status;
 
@@ -60,46 +104,167 @@ class PPU {
     union render_register {
         uint16 value = 0;
         struct {
-            uint16 coarse_x:5, coarse_y:5, nametable_x:1, nametable_y:1, fine_y:3, :1;
+            uint16 coarse_x:5, coarse_y:5, nametable_x:1, nametable_y:1, fine_y:3, reserved:1;
         };
     };
 
-    bool next_address_is_lsb = false; // see https://www.nesdev.org/wiki/PPU_registers#PPUADDR
+    struct ObjectAttribute {
+        uint8 y, id, attribute, x;
+    };
+
+    // shared by PPUSCROLL and PPUADDR, see https://www.nesdev.org/wiki/PPU_registers#PPUADDR
+    bool next_address_is_lsb = false;
+    uint8 fine_x = 0;
+    uint8 oam_addr = 0;
+    uint8 reserved0[2] = {};
 
     int scanline = 0;
     int cycle = 0;
 
-    SDL_Surface *screen;
-    SDL_Surface *pattern_tables[2] = {};
-    SDL_Surface *palettes[8] = {};
+    Mirroring current_mirroring = Mirroring::Horizontal;
 
-    /// Locates the address of addr somewhere in the ppu's RAM (name table, pattern, or palette memory arrays).
-    uint8 *ppu_locate(uint16 addr);
+    // dot-level background pipeline, see https://www.nesdev.org/wiki/PPU_rendering
+    uint8 bg_next_tile_id = 0;
+    uint8 bg_next_tile_attrib = 0;
+    uint8 bg_next_tile_lsb = 0;
+    uint8 bg_next_tile_msb = 0;
+    uint16 bg_shifter_pattern_lo = 0, bg_shifter_pattern_hi = 0;
+    uint16 bg_shifter_attrib_lo = 0, bg_shifter_attrib_hi = 0;
+
+    // sprites selected for the next scanline (at most 8, in OAM order)
+    ObjectAttribute sprite_scanline[8] = {};
+    int sprite_count = 0;
+    bool sprite_zero_possible = false; // sprite_scanline[0] is OAM entry 0
+    uint8 sprite_shifter_pattern_lo[8] = {}, sprite_shifter_pattern_hi[8] = {};
+    uint8 reserved1[3] = {};
+
+    // bulk path: which pixels have been drawn so far and what each scanline starts from
+    RenderPath frame_path = RenderPath::Timing; // the frame the PPU powers up in is only partial, so it isn't drawn
+    RenderPath next_frame_path = RenderPath::Fast;
+    RenderPath frame_started_on = RenderPath::Timing;
+    bool fallback_pending = false;
+    bool frame_has_complex_write = false;
+    uint8 reserved2[2] = {};
+    int rendered_line = 0, rendered_x = 0;
+    render_register line_start_addr[240] = {};
+    int sprite_line = -1; // scanline sprite_line_pixels was built for
+    uint8 sprite_line_pixels[256] = {}; // pixel | palette << 2 | in front << 4 | sprite zero << 5
+    int sprite_zero_hit_line = -1, sprite_zero_hit_cycle = -1;
 
 public:
     uint8 internal_read_buffer = 0;
+    uint8 reserved3 = 0;
     render_register vram_addr, tram_addr;
 
+    uint8 name_table_mem[4][1024] = {}; // pages 2 and 3 are only used by four-screen cartridges
+    uint8 palette_mem[32] = {};
+    uint8 oam_mem[256] = {};
+
+    bool finished_frame = false;
+    uint8 reserved4[5] = {};
+    uint64 frame_number = 0;
+    uint64 dots = 0; // dots clocked since power on
+};
+
+class PPU : public PPUState {
+    Bus &bus;
+    Cartridge *cartridge;
+
+    uint8 *name_table_pages[4] = {}; // physical page backing $2000, $2400, $2800 and $2C00
+
+    uint8 *frame = nullptr; // where pixels are drawn, either own_frame or a buffer supplied by the caller
+    std::unique_ptr<uint8[]> own_frame;
+
+    /// Locates the address of addr somewhere in the ppu's RAM (name table, pattern, or palette memory arrays).
+    uint8 *ppu_locate(uint16 addr);
+
+    /// Reads memory on behalf of the renderer. Unlike ppu_read this never triggers breakpoints.
+    uint8 render_read(uint16 addr);
+
+    bool rendering_enabled() const { return mask.show_background || mask.show_sprites; }
+
+    void increment_scroll_x();
+    void increment_scroll_y();
+    void transfer_address_x();
+    void transfer_address_y();
+
+    /// Selects (up to 8 of) the sprites visible on the scanline after `line`, in OAM order.
+    int select_sprites(int line, ObjectAttribute out[8], bool &includes_sprite_zero, bool &overflow) const;
+    /// Fetches the row of a sprite selected on `line` that is drawn on the following scanline.
+    void fetch_sprite_row(const ObjectAttribute &sprite, int line, uint8 &lsb, uint8 &msb);
+    /// Fetches the pattern row and palette of the `tile`th tile to the right of where `addr` points.
+    void fetch_background_tile(render_register addr, int tile, uint8 &lsb, uint8 &msb, uint8 &palette);
+
+    uint8 compose_pixel(int x, uint8 bg_pixel, uint8 bg_palette, uint8 fg_pixel, uint8 fg_palette, bool fg_in_front,
+                        bool fg_is_sprite_zero, bool &sprite_zero_hit) const;
+    void put_pixel(int x, int y, uint8 palette_index);
+    void ensure_frame_buffer();
+    /// Points name_table_pages at the nametables current_mirroring selects.
+    void map_name_tables();
+
+    // dot-level path
+    void load_background_shifters();
+    void update_shifters();
+    void clock_pipeline();
+    void draw_pipeline_pixel();
+
+    // bulk path
+    void clock_timing();
+    void build_sprite_line(int line);
+    void render_span(int line, int x0, int x1);
+    void catch_up();
+    void predict_sprite_zero_hit(int line, int first_x);
+    void log_frame_write(uint8 reg, uint8 data);
+    void begin_frame();
+    void finish_frame();
+    void clock_mapper_scanline();
+
+public:
     std::vector<uint16> address_read_breakpoints;
     std::vector<uint16> address_write_breakpoints;
 
-    uint8 name_table_mem[2][1024] = {};
-    uint8 palette_mem[32] = {};
+    bool force_precise = false; // always use the dot-level pipeline
+    // Draw only every Nth frame; the others just produce timing (vblank, NMI, sprite 0 hit, sprite overflow and
+    // mapper scanline clocks). 0 never draws, e.g. when running headless.
+    int render_interval = 1;
+    std::vector<FrameWrite> frame_writes; // writes logged during the current (or, in vblank, the last) frame
+    RenderStats render_stats;
 
-    bool finished_frame = false;
+    bool replica = false; // driven by a RenderThread's log rather than a CPU, so never stops on a breakpoint
+    RenderThread *render_thread = nullptr; // when set, frames are drawn there and this PPU only produces timing
 
     explicit PPU(Bus &bus, Cartridge *cartridge);
 
+    /// Copies all emulated state (registers, memory, beam position and the current frame) from another PPU.
+    void copy_state(const PPU &other);
+
+    /// Restores state saved from a PPU of the same cartridge, whose mirroring has to be restored already. Unlike
+    /// copy_state, the part of the current frame drawn before the state was saved isn't restored.
+    void load_state(const PPUState &state);
+
+    /// Passes an access on to the attached RenderThread, if there is one.
+    void record_event(PPUEvent::Kind kind, uint16 addr, uint8 data);
+
+    Mirroring mirroring() const { return current_mirroring; }
+
+    /// Rebuilds the nametable page table from the cartridge's mirroring. Must be called whenever it changes.
+    void update_mirroring();
+
     void ppu_write(uint16 addr, uint8 data);
     uint8 ppu_read(uint16 addr);
     void cpu_write(uint16 addr, uint8 data);
     uint8 cpu_read(uint16 addr);
 
-    SDL_Surface *render_screen();
-    SDL_Surface *render_pattern_table(int table, uint8 palette);
-    SDL_Surface *render_palette(int palette);
+    /// The last frame drawn, SCREEN_WIDTH * SCREEN_HEIGHT indices into palette_array. Null until a frame is drawn,
+    /// so a PPU that only produces timing never allocates one.
+    const uint8 *frame_buffer() const { return frame; }
+
+    /// Draws the frame that's about to begin even if render_interval or a render thread said it would only produce
+    /// timing. Does nothing unless a frame just finished, i.e. between two Bus::execute_one_frame calls.
+    void draw_next_frame();
 
-    SDL_Color color_from_palette(uint8 palette, uint8 pixel);
+    /// Draws into `buffer` (SCREEN_WIDTH * SCREEN_HEIGHT bytes) from now on, or into an internal buffer if null.
+    void set_frame_buffer(uint8 *buffer);
 
     void clock(bool &nmi_requested);
-};
\ No newline at end of file
+};
@@ -71,7 +71,20 @@ struct BreakpointException : std::exception {
 
 };
 
-class R6502 {
+/// The 6502's registers, all a save state needs of it.
+struct R6502State {
+    // internal processor registers
+    uint8 a = 0, x = 0, y = 0, sp = 0, status = 0;
+    uint8 reserved0 = 0;
+    uint16 pc = 0;
+
+    uint8 cycles = 0; // cycles left in current instruction
+    uint8 last_executed_opcode = 0;
+    bool finished_instruction = false;
+    uint8 reserved1 = 0;
+};
+
+class R6502 : public R6502State {
 
     void do_interrupt(Bus &bus, uint16 start_addr);
 
@@ -100,14 +113,6 @@ class R6502 {
     void write(Bus &bus, uint16 addr, uint8 data); // throws BreakpointException
 
 public:
-    // internal processor registers
-    uint8 a = 0, x = 0, y = 0, sp = 0, status = 0;
-    uint16 pc = 0;
-
-    uint8 cycles = 0; // cycles left in current instruction
-    uint8 last_executed_opcode = 0;
-    bool finished_instruction = false;
-
     // emulator pauses execution when the cpu touches any of these addresses
     std::vector<uint16> address_read_breakpoints;
     std::vector<uint16> address_write_breakpoints;
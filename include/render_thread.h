@@ -0,0 +1,60 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "bus.h"
+#include "ring_buffer.h"
+
+/// Draws a bus's frames on a worker thread.
+///
+/// While attached, the bus's PPU only produces what the CPU can observe (vblank, NMI, sprite 0 hit, sprite overflow
+/// and mapper scanline clocks) and logs every access that changes the picture, stamped with the dot it happened on.
+/// The worker replays that log into its own PPU and copy of the cartridge, drawing frame N while the CPU is already
+/// running frame N + 1.
+class RenderThread {
+    static constexpr size_t LOG_CAPACITY = 1 << 16; // a few frames' worth, including OAM DMAs
+
+    Bus &bus;
+    Cartridge cartridge;
+    PPU ppu;
+
+    RingBuffer<PPUEvent> log;
+    std::atomic<bool> running = true;
+    std::atomic<bool> resyncing = false; // set by resync until the worker has copied the bus's state
+    std::thread worker;
+
+    std::mutex frame_mutex;
+    std::vector<uint8> frame;
+    RenderStats frame_stats;
+
+    void run();
+    void apply(const PPUEvent &event);
+    void copy_bus_state();
+    void publish_frame();
+
+public:
+    std::atomic<uint64> frames_rendered = 0;
+
+    /// Takes over drawing from the bus's PPU. Must not be constructed while the bus is being clocked.
+    explicit RenderThread(Bus &bus);
+    ~RenderThread();
+
+    RenderThread(const RenderThread &) = delete;
+    RenderThread &operator=(const RenderThread &) = delete;
+
+    /// Called by the bus's PPU, on the emulation thread. Waits for the worker if the log is full.
+    void record(const PPUEvent &event);
+    /// Puts the worker's PPU and cartridge back in the bus's state after that was replaced, e.g. by a state being
+    /// loaded. Waits for the worker to draw what was logged before and copy it. Only between clocks.
+    void resync();
+
+    /// The last complete frame, laid out like PPU::frame_buffer. The worker can't publish another one until it is
+    /// released.
+    const uint8 *acquire_frame();
+    void release_frame();
+
+    RenderStats stats();
+};
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "bus.h"
+#include "ring_buffer.h"
+
+/// Bounded history of per-frame machine states, to step the emulation backwards.
+///
+/// push() only copies the state into a lock-free ring; a background thread compresses it and files it away, so
+/// capturing costs the emulation thread a memcpy per frame. Every `keyframe_interval` frames a state is kept whole,
+/// the ones in between as their XOR against that keyframe, and both are run-length coded: between two frames most of
+/// the machine doesn't change, so the deltas are mostly runs of zeros. Once the history takes up more than the budget,
+/// the oldest keyframe is dropped together with the deltas that depend on it.
+class Rewind {
+public:
+    struct Stats {
+        size_t frames = 0; // states that can be stepped back through
+        size_t bytes = 0;  // memory they take up, compressed
+        uint64 dropped = 0; // states pushed while the ring was full, which leave a gap in the history
+    };
+
+private:
+    static constexpr size_t RING_CAPACITY = 16; // frames, a quarter second of slack for the compressor
+    static constexpr auto WAKE_INTERVAL = std::chrono::milliseconds(20);
+
+    struct Entry {
+        uint64 frame; // counts up with every state stored
+        bool keyframe;
+        std::vector<uint8> data; // run-length coded state, or XOR against the keyframe before it
+    };
+
+    const size_t budget;
+    const int keyframe_interval;
+
+    RingBuffer<MachineState> ring;
+
+    // everything below is only touched with the lock held
+    std::mutex lock;
+    std::deque<Entry> history;
+    size_t history_bytes = 0;
+    std::unique_ptr<MachineState> keyframe;         // the newest keyframe, which new deltas are taken against
+    std::unique_ptr<MachineState> scratch;          // the state being compressed
+    std::unique_ptr<MachineState> decoded_keyframe; // cached across pop(), which mostly decodes the same one
+    uint64 decoded_frame = UINT64_MAX;
+    uint64 next_frame = 0;
+    int frames_since_keyframe = 0;
+    bool has_keyframe = false;
+    std::vector<uint8> encoded;
+
+    std::atomic<uint64> dropped = 0;
+    std::atomic<size_t> stats_frames = 0, stats_bytes = 0;
+
+    std::atomic<bool> running = true;
+    std::thread worker;
+
+    void run();
+    void drain();
+    void store(const MachineState &state);
+    void evict();
+    void update_stats();
+
+public:
+    /// @param budget bytes the compressed history may take up, a minute at 60 fps fits in a few MB
+    /// @param threaded compress on a background thread, otherwise push() does it right away
+    explicit Rewind(size_t budget, int keyframe_interval = 60, bool threaded = true);
+    ~Rewind();
+
+    Rewind(const Rewind &) = delete;
+    Rewind &operator=(const Rewind &) = delete;
+
+    /// Never blocks; dropped if the compressor is that far behind.
+    void push(const MachineState &state);
+
+    /// Takes the newest state off the history. Returns false if there's none left.
+    bool pop(MachineState &state);
+
+    /// Forgets the whole history.
+    void clear();
+
+    Stats stats() const { return {stats_frames.load(), stats_bytes.load(), dropped.load()}; }
+};
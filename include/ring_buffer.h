@@ -0,0 +1,79 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+/// Lock-free queue for exactly one producer thread and one consumer thread.
+template<typename T>
+class RingBuffer {
+    std::unique_ptr<T[]> items;
+    size_t mask;
+
+    // each index is only ever written by one side, on separate cache lines so the two threads don't fight over them
+    alignas(64) std::atomic<size_t> head{0}; // next slot the producer writes
+    alignas(64) std::atomic<size_t> tail{0}; // next slot the consumer reads
+
+public:
+    /// @param capacity must be a power of two
+    explicit RingBuffer(size_t capacity) : items(new T[capacity]), mask(capacity - 1) {
+        ASSERT(capacity > 0 && (capacity & (capacity - 1)) == 0, "capacity %zu is not a power of two", capacity);
+    }
+
+    RingBuffer(const RingBuffer &) = delete;
+    RingBuffer &operator=(const RingBuffer &) = delete;
+
+    size_t capacity() const { return mask + 1; }
+
+    /// Number of items queued. Exact when called from either side, an estimate from anywhere else.
+    size_t size() const {
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+    }
+
+    /// Producer only. Returns false if the queue is full.
+    bool push(const T &item) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) > mask)
+            return false;
+
+        items[h & mask] = item;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// Consumer only. Returns false if the queue is empty.
+    bool pop(T &item) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire))
+            return false;
+
+        item = items[t & mask];
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// Producer only. Pushes as many of the `count` items as fit, returns how many that was.
+    size_t push(const T *src, size_t count) {
+        size_t h = head.load(std::memory_order_relaxed);
+        count = std::min(count, capacity() - (h - tail.load(std::memory_order_acquire)));
+
+        // in at most two runs, up to the end of the storage and then from its start
+        size_t first = std::min(count, capacity() - (h & mask));
+        std::copy(src, src + first, &items[h & mask]);
+        std::copy(src + first, src + count, &items[0]);
+        head.store(h + count, std::memory_order_release);
+        return count;
+    }
+
+    /// Consumer only. Pops up to `count` items, returns how many that was.
+    size_t pop(T *dst, size_t count) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        count = std::min(count, head.load(std::memory_order_acquire) - t);
+
+        size_t first = std::min(count, capacity() - (t & mask));
+        std::copy(&items[t & mask], &items[t & mask] + first, dst);
+        std::copy(&items[0], &items[0] + (count - first), dst + first);
+        tail.store(t + count, std::memory_order_release);
+        return count;
+    }
+};
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "bus.h"
+
+/// Save state files: a small header followed by a MachineState as raw bytes.
+///
+/// The state is stored in the host's layout, so a file only loads into a build with the same MachineState::VERSION
+/// and struct size, and only for the ROM it was saved from. Anything else is refused with a warning rather than
+/// loaded half right.
+namespace save_state {
+    constexpr char MAGIC[4] = {'N', 'E', 'S', 'S'};
+
+    struct FileHeader {
+        char magic[4];
+        uint32 version;    // MachineState::VERSION
+        uint32 state_size; // sizeof(MachineState), which catches layout changes nobody bumped the version for
+        uint32 reserved = 0;
+        uint64 rom_hash;   // Cartridge::rom_hash
+        uint64 state_hash; // of the MachineState that follows, to catch truncated or corrupted files
+    };
+
+    static_assert(sizeof(FileHeader) == 32, "the header is part of the file format");
+
+    bool write(const char *path, const MachineState &state, uint64 rom_hash);
+    bool read(const char *path, MachineState &state, uint64 rom_hash);
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <array>
+#include <unordered_map>
+#include <vector>
+
+#include "bus.h"
+
+/// Keeps many MachineStates, like the nodes of a search tree or a long rewind archive, in far less memory than
+/// copies of them would take.
+///
+/// Each state is cut into pages of at most PAGE_SIZE, and every page is interned by its contents: a state is only a
+/// table of page numbers, and pages that are the same in many states (most of RAM, the nametables and the mapper's
+/// registers between nearby frames, and the parts of the machine a game never touches) are stored once and reference
+/// counted. Pages are cut at the edges of RAM, the nametables and OAM with the palette, so none of them shares a page
+/// with the registers and counters that change every frame. Putting a state costs hashing it, getting one back is a
+/// memcpy per page.
+class StateStore {
+public:
+    static constexpr size_t PAGE_SIZE = 256;
+
+    using Id = uint32;
+
+    struct Stats {
+        size_t states = 0;
+        size_t pages = 0;          // distinct pages stored
+        size_t logical_bytes = 0;  // what the states would take up as MachineStates
+        size_t resident_bytes = 0; // what the store takes up, bookkeeping included
+        /// Page references per page stored, i.e. how many copies of each page a store without sharing would keep.
+        double dedup_ratio = 0;
+    };
+
+private:
+    static constexpr uint32 NO_PAGE = UINT32_MAX; // first entry of a released state's table
+
+    /// Where a page is in every state. The last page of a region may be short, it's stored padded with zeros.
+    struct Span {
+        uint32 offset, size;
+    };
+
+    struct Page {
+        uint64 hash;
+        uint32 references; // 0 when free, for reuse
+        std::array<uint8, PAGE_SIZE> data;
+    };
+
+    std::vector<Span> spans; // how every state is cut into pages
+    std::vector<Page> pages;
+    std::vector<uint32> free_pages;
+    std::unordered_multimap<uint64, uint32> index; // page contents' hash -> page, with collisions told apart by contents
+    std::vector<uint32> tables; // spans.size() page numbers per state
+    std::vector<Id> free_states;
+    size_t live_states = 0;
+    size_t page_references = 0;
+
+    uint32 intern(const uint8 *data);
+    void release_page(uint32 page);
+    uint32 *table(Id id) { return &tables[id * spans.size()]; }
+    const uint32 *table(Id id) const { return &tables[id * spans.size()]; }
+
+public:
+    StateStore();
+
+    /// Stores a copy of `state`, and returns what to get it back with.
+    Id put(const MachineState &state);
+    void get(Id id, MachineState &state) const;
+    /// Forgets a state, after which its id may be handed out again. Pages no other state uses are freed for reuse.
+    void release(Id id);
+    void clear();
+
+    Stats stats() const;
+};
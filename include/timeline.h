@@ -0,0 +1,72 @@
+#pragma once
+
+#include <deque>
+
+#include "bus.h"
+
+/// Lets the debugger step and continue backwards.
+///
+/// While the bus moves forward, a keyframe of the whole machine is taken every so often, and every change of the
+/// controllers is logged with the clock it came on. Emulation is deterministic, so any earlier point can be reached
+/// again by restoring the newest keyframe before it and re-running the clocks in between with the same inputs,
+/// muted and without drawing. With keyframes a few frames apart that's a few milliseconds however far back it goes.
+///
+/// Stopping on a breakpoint changes what happens next (the interrupted clock runs again on resuming), so a
+/// keyframe is also taken there: re-running never has to reproduce a stop, only to find where one would happen.
+class Timeline {
+    struct Keyframe {
+        uint64 clock;
+        bool interrupted; // taken while stopped on a breakpoint, in the middle of that clock
+        uint8 controller[2];
+        MachineState state;
+    };
+
+    struct InputChange {
+        uint64 clock; // applied right before this clock runs
+        uint8 controller[2];
+    };
+
+    uint64 keyframe_interval;
+    size_t max_keyframes;
+    std::deque<Keyframe> keyframes; // oldest first
+    std::deque<InputChange> inputs; // oldest first, none before the oldest keyframe
+    double last_ms = 0;
+
+    void take_keyframe(const Bus &bus, bool interrupted);
+    void truncate(uint64 clock);
+    size_t keyframe_before(uint64 clock) const;
+    /// Restores keyframes[index] and runs until the bus is at `clock`, calling `before_clock(bus)` before each.
+    template<typename F>
+    void replay(Bus &bus, size_t index, uint64 clock, F before_clock) const;
+
+public:
+    struct Stats {
+        size_t keyframes = 0;
+        double seconds = 0; // how far back history goes
+        double last_ms = 0; // host time the last step or continue back took
+    };
+
+    /// @param keyframe_interval PPU clocks between keyframes, which is the most a step back re-runs
+    /// @param max_keyframes together with the interval, how far back history goes
+    Timeline(uint64 keyframe_interval, size_t max_keyframes);
+
+    /// Called before the bus moves forward from where it is, with the controllers already set. Takes a keyframe if
+    /// it's time to, and logs the controllers if they changed.
+    void record(const Bus &bus);
+    /// Called right after the bus stopped on a breakpoint.
+    void record_interruption(const Bus &bus);
+    /// For when the bus jumps somewhere history doesn't lead to, like loading a state or a reset.
+    void clear();
+
+    /// Moves the bus back to right after the last instruction that ran before where it is, i.e. undoes a
+    /// Bus::execute_one_instruction. Returns false, leaving the bus as it was, if history doesn't go back that far.
+    /// Whatever was recorded after that point is forgotten. A RenderThread attached has to be recreated afterwards.
+    bool step_back(Bus &bus);
+    /// Moves the bus back to the last point before where it is that one of the CPU's or PPU's breakpoints would
+    /// have stopped it, stopped there just like running into it. Returns false, leaving the bus as it was, if
+    /// there's none in history. Whatever was recorded after that point is forgotten. A RenderThread attached has to
+    /// be recreated afterwards.
+    bool continue_back(Bus &bus);
+
+    Stats stats() const;
+};
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <atomic>
+
+/// Hands the newest of a stream of values from exactly one producer thread to exactly one consumer thread, without
+/// either ever waiting or the consumer ever seeing a half-written value.
+///
+/// Of the three slots, one belongs to the producer, one to the consumer, and the third holds the last published
+/// value. Publishing and picking up swap a side's slot with that third one atomically; values the consumer was too
+/// slow to pick up are simply overwritten.
+template<typename T>
+class TripleBuffer {
+    static constexpr uint8 FRESH = 4; // set on the shared index when it holds a value the consumer hasn't seen
+
+    T slots[3];
+    uint8 write_slot = 0; // only touched by the producer
+    uint8 read_slot = 1;  // only touched by the consumer
+    alignas(64) std::atomic<uint8> shared_slot{2};
+
+public:
+    TripleBuffer() = default;
+    TripleBuffer(const TripleBuffer &) = delete;
+    TripleBuffer &operator=(const TripleBuffer &) = delete;
+
+    /// The producer's slot. Holds an older value, not necessarily the last one published, so it has to be rewritten
+    /// in full.
+    T &write_buffer() { return slots[write_slot]; }
+
+    void publish() {
+        write_slot = shared_slot.exchange(write_slot | FRESH, std::memory_order_acq_rel) & 3;
+    }
+
+    /// Switches the consumer's slot to the newest published value, if there is one. Returns whether it did.
+    bool update() {
+        if (!(shared_slot.load(std::memory_order_relaxed) & FRESH))
+            return false;
+        read_slot = shared_slot.exchange(read_slot, std::memory_order_acq_rel) & 3;
+        return true;
+    }
+
+    /// The consumer's slot, valid until the next update().
+    const T &read_buffer() const { return slots[read_slot]; }
+};
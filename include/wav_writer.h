@@ -0,0 +1,44 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+#include "ring_buffer.h"
+
+/// Streams mono 16-bit samples into a .wav file.
+///
+/// push() only copies into a lock-free ring, a background thread does the file I/O, so a slow disk drops samples
+/// (counted in `dropped`) instead of stalling emulation. The header is rewritten about once a second, so a capture
+/// that's cut short by a crash is still playable up to that point.
+class WavWriter {
+    static constexpr size_t RING_CAPACITY = 1 << 17; // samples, over a second even at 96 kHz
+    static constexpr auto WAKE_INTERVAL = std::chrono::milliseconds(20);
+
+    FILE *file = nullptr;
+    int sample_rate;
+
+    RingBuffer<int16> ring;
+    std::atomic<bool> running = true;
+    std::thread worker;
+
+    void run();
+    void write_header(uint64 samples);
+
+public:
+    std::atomic<uint64> samples_written = 0;
+    std::atomic<uint64> dropped = 0;
+
+    WavWriter(const char *path, int sample_rate);
+    /// Writes whatever is still queued and finishes the file.
+    ~WavWriter();
+
+    WavWriter(const WavWriter &) = delete;
+    WavWriter &operator=(const WavWriter &) = delete;
+
+    bool is_open() const { return file != nullptr; }
+
+    /// Never blocks; whatever doesn't fit is dropped.
+    void push(const int16 *samples, int count);
+};
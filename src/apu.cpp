@@ -0,0 +1,640 @@
+#include "apu.h"
+
+#include <algorithm>
+#include <iterator>
+
+#include "bus.h"
+
+namespace {
+    constexpr uint8 LENGTH_TABLE[32] = {
+        10, 254, 20,  2, 40,  4, 80,  6, 160,  8, 60, 10, 14, 12, 26, 14,
+        12,  16, 24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30,
+    };
+
+    constexpr uint8 DUTY_TABLE[4][8] = {
+        {0, 1, 0, 0, 0, 0, 0, 0}, // 12.5%
+        {0, 1, 1, 0, 0, 0, 0, 0}, // 25%
+        {0, 1, 1, 1, 1, 0, 0, 0}, // 50%
+        {1, 0, 0, 1, 1, 1, 1, 1}, // 25% negated
+    };
+
+    constexpr uint16 NOISE_PERIODS[16] = { // in APU cycles
+        2, 4, 8, 16, 32, 48, 64, 80, 101, 127, 190, 254, 381, 508, 1017, 2034,
+    };
+
+    constexpr uint16 DMC_RATES[16] = { // in CPU cycles
+        428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106, 84, 72, 54,
+    };
+
+    constexpr int VOLUME = 20000;          // amplitude of the loudest possible output
+    constexpr uint32 AUDIO_FRAME_CLOCKS = 4096; // how often samples are made readable, about 2.3 ms
+
+    // https://www.nesdev.org/wiki/APU_Mixer#Lookup_Table
+    struct MixTables {
+        int pulse[31];
+        int tnd[203];
+
+        MixTables() {
+            pulse[0] = 0;
+            for (int i = 1; i < 31; i++)
+                pulse[i] = static_cast<int>(95.52 / (8128.0 / i + 100) * VOLUME);
+            tnd[0] = 0;
+            for (int i = 1; i < 203; i++)
+                tnd[i] = static_cast<int>(163.67 / (24329.0 / i + 100) * VOLUME);
+        }
+    };
+
+    const MixTables &mix_tables() {
+        static const MixTables tables;
+        return tables;
+    }
+
+    // Same as `ticks` clocks of a timer that counts down and reloads with `period` once it's clocked at 0. Returns how
+    // many times it reloaded.
+    uint64 run_timer(uint16 &timer, uint16 period, uint64 ticks) {
+        if (ticks <= timer) {
+            timer -= ticks;
+            return 0;
+        }
+        ticks -= timer + 1;
+        timer = static_cast<uint16>(period - ticks % (period + 1));
+        return 1 + ticks / (period + 1);
+    }
+
+    // https://www.nesdev.org/wiki/APU_Frame_Counter, in CPU cycles since $4017 was written
+    constexpr uint32 FOUR_STEP_SEQUENCE[] = {7457, 14913, 22371, 29828, 29829, 29830};
+    constexpr uint32 FIVE_STEP_SEQUENCE[] = {7457, 14913, 22371, 37281, 37282};
+}
+
+void APU::Envelope::clock() {
+    if (start) {
+        start = false;
+        decay = 15;
+        divider = volume;
+    } else if (divider == 0) {
+        divider = volume;
+        if (decay > 0)
+            decay--;
+        else if (loop)
+            decay = 15;
+    } else {
+        divider--;
+    }
+}
+
+void APU::Pulse::write(int reg, uint8 data) {
+    switch (reg) {
+
+    case 0:
+        duty = data >> 6;
+        envelope.loop = data & 0x20;
+        envelope.constant = data & 0x10;
+        envelope.volume = data & 0xf;
+        break;
+    case 1:
+        sweep_enabled = data & 0x80;
+        sweep_period = (data >> 4) & 7;
+        sweep_negate = data & 0x08;
+        sweep_shift = data & 7;
+        sweep_reload = true;
+        break;
+    case 2:
+        period = (period & 0x700) | data;
+        break;
+    case 3:
+        period = (period & 0xff) | ((data & 7) << 8);
+        if (enabled)
+            length = LENGTH_TABLE[data >> 3];
+        step = 0;
+        envelope.start = true;
+        break;
+    default:
+        UNREACHABLE("pulse has no register %d", reg);
+
+    }
+}
+
+void APU::Pulse::clock_timer() {
+    if (timer == 0) {
+        timer = period;
+        step = (step + 1) & 7;
+    } else {
+        timer--;
+    }
+}
+
+void APU::Pulse::skip(uint64 ticks) {
+    step = (step + run_timer(timer, period, ticks)) & 7;
+}
+
+void APU::Pulse::clock_length() {
+    if (!envelope.loop && length > 0)
+        length--;
+}
+
+int APU::Pulse::sweep_target() const {
+    int change = period >> sweep_shift;
+    if (!sweep_negate)
+        return period + change;
+    return period - change - (ones_complement_sweep ? 1 : 0);
+}
+
+void APU::Pulse::clock_sweep() {
+    // https://www.nesdev.org/wiki/APU_Sweep
+    int target = sweep_target();
+    if (sweep_divider == 0 && sweep_enabled && sweep_shift > 0 && period >= 8 && target <= 0x7ff)
+        period = std::max(target, 0);
+
+    if (sweep_divider == 0 || sweep_reload) {
+        sweep_divider = sweep_period;
+        sweep_reload = false;
+    } else {
+        sweep_divider--;
+    }
+}
+
+uint8 APU::Pulse::output() const {
+    // the sweep unit mutes the channel when the period is out of range, even while it is disabled
+    if (length == 0 || period < 8 || sweep_target() > 0x7ff || !DUTY_TABLE[duty][step])
+        return 0;
+    return envelope.output();
+}
+
+void APU::Triangle::write(int reg, uint8 data) {
+    switch (reg) {
+
+    case 0:
+        control = data & 0x80;
+        linear_reload_value = data & 0x7f;
+        break;
+    case 1:
+        break;
+    case 2:
+        period = (period & 0x700) | data;
+        break;
+    case 3:
+        period = (period & 0xff) | ((data & 7) << 8);
+        if (enabled)
+            length = LENGTH_TABLE[data >> 3];
+        linear_reload = true;
+        break;
+    default:
+        UNREACHABLE("triangle has no register %d", reg);
+
+    }
+}
+
+void APU::Triangle::clock_timer() {
+    if (timer == 0) {
+        timer = period;
+        // periods below 2 are ultrasonic and used by games to silence the channel, so the sequencer is held
+        // instead of producing a stream of inaudible steps
+        if (stepping())
+            step = (step + 1) & 31;
+    } else {
+        timer--;
+    }
+}
+
+void APU::Triangle::skip(uint64 cycles) {
+    uint64 reloads = run_timer(timer, period, cycles);
+    if (stepping())
+        step = (step + reloads) & 31;
+}
+
+void APU::Triangle::clock_length() {
+    if (!control && length > 0)
+        length--;
+}
+
+void APU::Triangle::clock_linear() {
+    if (linear_reload)
+        linear = linear_reload_value;
+    else if (linear > 0)
+        linear--;
+
+    if (!control)
+        linear_reload = false;
+}
+
+void APU::Noise::write(int reg, uint8 data) {
+    switch (reg) {
+
+    case 0:
+        envelope.loop = data & 0x20;
+        envelope.constant = data & 0x10;
+        envelope.volume = data & 0xf;
+        break;
+    case 1:
+        break;
+    case 2:
+        mode = data & 0x80;
+        period = NOISE_PERIODS[data & 0xf];
+        break;
+    case 3:
+        if (enabled)
+            length = LENGTH_TABLE[data >> 3];
+        envelope.start = true;
+        break;
+    default:
+        UNREACHABLE("noise has no register %d", reg);
+
+    }
+}
+
+void APU::Noise::clock_timer() {
+    if (timer == 0) {
+        timer = period;
+        clock_shift();
+    } else {
+        timer--;
+    }
+}
+
+void APU::Noise::clock_shift() {
+    uint16 feedback = (shift & 1) ^ ((shift >> (mode ? 6 : 1)) & 1);
+    shift = (shift >> 1) | (feedback << 14);
+}
+
+void APU::Noise::skip(uint64 ticks) {
+    // the shift register has no shortcut, but muted stretches are still cheap compared to clocking every cycle
+    for (uint64 reloads = run_timer(timer, period, ticks); reloads > 0; reloads--)
+        clock_shift();
+}
+
+void APU::Noise::clock_length() {
+    if (!envelope.loop && length > 0)
+        length--;
+}
+
+void APU::DMC::write(int reg, uint8 data) {
+    switch (reg) {
+
+    case 0:
+        irq_enabled = data & 0x80;
+        if (!irq_enabled)
+            irq = false;
+        loop = data & 0x40;
+        rate = DMC_RATES[data & 0xf];
+        break;
+    case 1:
+        output_level = data & 0x7f;
+        break;
+    case 2:
+        sample_addr = 0xc000 + data * 64;
+        break;
+    case 3:
+        sample_length = data * 16 + 1;
+        break;
+    default:
+        UNREACHABLE("DMC has no register %d", reg);
+
+    }
+}
+
+void APU::DMC::clock_output() {
+    // https://www.nesdev.org/wiki/APU_DMC#Output_unit
+    if (!silence) {
+        if (shift & 1) {
+            if (output_level <= 125)
+                output_level += 2;
+        } else if (output_level >= 2) {
+            output_level -= 2;
+        }
+    }
+    shift >>= 1;
+
+    if (--bits_remaining == 0) {
+        bits_remaining = 8;
+        silence = buffer_empty;
+        if (!buffer_empty) {
+            shift = sample_buffer;
+            buffer_empty = true;
+        }
+    }
+}
+
+void APU::cpu_write(uint16 addr, uint8 data) {
+    catch_up();
+
+    switch (addr) {
+
+    case 0x4000: case 0x4001: case 0x4002: case 0x4003:
+        pulse[0].write(addr & 3, data);
+        break;
+    case 0x4004: case 0x4005: case 0x4006: case 0x4007:
+        pulse[1].write(addr & 3, data);
+        break;
+    case 0x4008: case 0x4009: case 0x400a: case 0x400b:
+        triangle.write(addr & 3, data);
+        break;
+    case 0x400c: case 0x400d: case 0x400e: case 0x400f:
+        noise.write(addr & 3, data);
+        break;
+    case 0x4010: case 0x4011: case 0x4012: case 0x4013:
+        dmc.write(addr & 3, data);
+        break;
+
+    case 0x4015:
+        // https://www.nesdev.org/wiki/APU#Status_($4015)
+        pulse[0].enabled = data & 0x01;
+        pulse[1].enabled = data & 0x02;
+        triangle.enabled = data & 0x04;
+        noise.enabled = data & 0x08;
+        if (!pulse[0].enabled) pulse[0].length = 0;
+        if (!pulse[1].enabled) pulse[1].length = 0;
+        if (!triangle.enabled) triangle.length = 0;
+        if (!noise.enabled) noise.length = 0;
+
+        dmc.irq = false;
+        if (!(data & 0x10))
+            dmc.bytes_remaining = 0;
+        else if (dmc.bytes_remaining == 0)
+            dmc.restart();
+        break;
+
+    case 0x4017:
+        // the reset really happens 3 or 4 cycles after the write, which isn't modelled
+        five_step = data & 0x80;
+        irq_inhibit = data & 0x40;
+        if (irq_inhibit)
+            frame_irq = false;
+        frame_counter_cycle = 0;
+        if (five_step) {
+            clock_quarter_frame();
+            clock_half_frame();
+        }
+        break;
+
+    default:
+        break;
+
+    }
+
+    // the new output is mixed on the next cycle, and the write may have moved the next IRQ or fetch
+    mix_changed = true;
+    schedule_sync();
+}
+
+uint8 APU::cpu_read(uint16 addr) {
+    if (addr != 0x4015)
+        return 0;
+    catch_up();
+
+    uint8 data = (pulse[0].length > 0)
+                 | (pulse[1].length > 0) << 1
+                 | (triangle.length > 0) << 2
+                 | (noise.length > 0) << 3
+                 | (dmc.bytes_remaining > 0) << 4
+                 | frame_irq << 6
+                 | dmc.irq << 7;
+    frame_irq = false;
+    return data;
+}
+
+void APU::load_state(const APUState &state) {
+    APUState::operator=(state);
+    mix_changed = true;
+}
+
+void APU::reset() {
+    cpu_write(0x4015, 0);
+}
+
+void APU::clock_quarter_frame() {
+    pulse[0].envelope.clock();
+    pulse[1].envelope.clock();
+    noise.envelope.clock();
+    triangle.clock_linear();
+}
+
+void APU::clock_half_frame() {
+    pulse[0].clock_length();
+    pulse[1].clock_length();
+    triangle.clock_length();
+    noise.clock_length();
+    pulse[0].clock_sweep();
+    pulse[1].clock_sweep();
+}
+
+void APU::clock_frame_counter() {
+    frame_counter_cycle++;
+
+    switch (frame_counter_cycle) {
+
+    case 7457:
+        clock_quarter_frame();
+        break;
+    case 14913:
+        clock_quarter_frame();
+        clock_half_frame();
+        break;
+    case 22371:
+        clock_quarter_frame();
+        break;
+    case 29828:
+        if (!five_step && !irq_inhibit)
+            frame_irq = true;
+        break;
+    case 29829:
+        if (!five_step) {
+            clock_quarter_frame();
+            clock_half_frame();
+            if (!irq_inhibit)
+                frame_irq = true;
+        }
+        break;
+    case 29830:
+        if (!five_step) {
+            if (!irq_inhibit)
+                frame_irq = true;
+            frame_counter_cycle = 0;
+        }
+        break;
+    case 37281:
+        clock_quarter_frame();
+        clock_half_frame();
+        break;
+    case 37282:
+        frame_counter_cycle = 0;
+        break;
+    default:
+        break;
+
+    }
+}
+
+void APU::clock_dmc() {
+    if (dmc.timer == 0) {
+        dmc.timer = dmc.rate - 1;
+        dmc.clock_output();
+    } else {
+        dmc.timer--;
+    }
+
+    // memory reader
+    if (dmc.buffer_empty && dmc.bytes_remaining > 0) {
+        dmc.sample_buffer = bus.read(dmc.current_addr);
+        dmc.buffer_empty = false;
+        // the fetch steals the bus from the cpu; the exact count depends on what the cpu was doing
+        bus.dma_cycles += 4;
+
+        dmc.current_addr = dmc.current_addr == 0xffff ? 0x8000 : dmc.current_addr + 1;
+        if (--dmc.bytes_remaining == 0) {
+            if (dmc.loop)
+                dmc.restart();
+            else if (dmc.irq_enabled)
+                dmc.irq = true;
+        }
+    }
+}
+
+int APU::mix() const {
+    auto &tables = mix_tables();
+    return tables.pulse[pulse[0].output() + pulse[1].output()]
+           + tables.tnd[3 * triangle.output() + 2 * noise.output() + dmc.output()];
+}
+
+void APU::set_sample_rate(int rate, BlipBuffer::Quality quality) {
+    catch_up();
+    sample_rate = rate;
+    if (rate <= 0) {
+        blip.reset();
+        return;
+    }
+
+    // a quarter of a second, so samples can be read once per video frame with plenty of slack
+    blip = std::make_unique<BlipBuffer>(CPU_CLOCK_RATE, rate, rate / 4, quality);
+    blip_clock = 0;
+    amplitude = 0;
+}
+
+void APU::end_audio_frame() {
+    blip->end_frame(blip_clock);
+    blip_clock = 0;
+    // only between frames, deltas already added in this one were placed at the old rate
+    blip->set_rates(CPU_CLOCK_RATE, sample_rate * rate_adjustment);
+
+    // nobody is reading (e.g. the emulator is paused in the debugger), keep only the most recent samples
+    if (blip->samples_available() > blip->capacity() / 2) {
+        int16 discard[512];
+        while (blip->samples_available() > blip->capacity() / 4)
+            blip->read_samples(discard, std::min<int>(512, blip->samples_available() - blip->capacity() / 4));
+    }
+}
+
+int APU::samples_available() {
+    if (!blip)
+        return 0;
+    catch_up();
+    end_audio_frame();
+    return blip->samples_available();
+}
+
+int APU::read_samples(int16 *out, int count) {
+    if (!blip)
+        return 0;
+    catch_up();
+    end_audio_frame();
+    return blip->read_samples(out, count);
+}
+
+uint32 APU::next_frame_counter_step() const {
+    auto begin = five_step ? std::begin(FIVE_STEP_SEQUENCE) : std::begin(FOUR_STEP_SEQUENCE);
+    auto end = five_step ? std::end(FIVE_STEP_SEQUENCE) : std::end(FOUR_STEP_SEQUENCE);
+    auto next = std::upper_bound(begin, end, frame_counter_cycle);
+    ASSERT(next != end, "frame counter ran past its last step (%u)", frame_counter_cycle);
+    return *next;
+}
+
+uint64 APU::next_dmc_fetch() const {
+    if (dmc.bytes_remaining == 0)
+        return UINT64_MAX;
+    if (dmc.buffer_empty)
+        return synced_cycles;
+    // the buffer is emptied into the shift register when the output unit runs out of bits
+    return synced_cycles + dmc.timer + static_cast<uint64>(dmc.bits_remaining - 1) * dmc.rate;
+}
+
+uint64 APU::next_event() const {
+    if (mix_changed)
+        return synced_cycles;
+
+    uint64 next = synced_cycles + (next_frame_counter_step() - frame_counter_cycle - 1);
+    next = std::min(next, next_dmc_fetch());
+
+    // only timers that can change the output when they reload are stepped through, the rest are skipped over
+    uint64 first_tick = synced_cycles | 1;
+    for (auto &p : pulse) {
+        if (p.audible())
+            next = std::min(next, first_tick + 2 * p.timer);
+    }
+    if (triangle.stepping())
+        next = std::min(next, synced_cycles + triangle.timer);
+    if (noise.audible())
+        next = std::min(next, first_tick + 2 * noise.timer);
+    if (!dmc.silence)
+        next = std::min(next, synced_cycles + dmc.timer);
+    else if (!dmc.buffer_empty) // playback resumes once the current byte has been shifted out
+        next = std::min(next, synced_cycles + dmc.timer + static_cast<uint64>(dmc.bits_remaining - 1) * dmc.rate);
+
+    if (blip && !muted)
+        next = std::min<uint64>(next, synced_cycles + (AUDIO_FRAME_CLOCKS - 1 - blip_clock));
+    return next;
+}
+
+void APU::step() {
+    clock_frame_counter();
+
+    triangle.clock_timer();
+    if (synced_cycles & 1) {
+        pulse[0].clock_timer();
+        pulse[1].clock_timer();
+        noise.clock_timer();
+    }
+    clock_dmc();
+    synced_cycles++;
+    mix_changed = false;
+
+    if (!blip || muted)
+        return;
+
+    int output = mix();
+    if (output != amplitude) {
+        blip->add_delta(blip_clock, output - amplitude);
+        amplitude = output;
+    }
+    if (++blip_clock == AUDIO_FRAME_CLOCKS)
+        end_audio_frame();
+}
+
+void APU::skip(uint64 count) {
+    uint64 ticks = (synced_cycles + count) / 2 - synced_cycles / 2; // odd cycles in the range
+
+    frame_counter_cycle += count;
+    triangle.skip(count);
+    pulse[0].skip(ticks);
+    pulse[1].skip(ticks);
+    noise.skip(ticks);
+    for (uint64 reloads = run_timer(dmc.timer, dmc.rate - 1, count); reloads > 0; reloads--)
+        dmc.clock_output();
+
+    synced_cycles += count;
+    if (blip && !muted)
+        blip_clock += count;
+}
+
+void APU::catch_up() {
+    while (synced_cycles < cycles) {
+        uint64 event = reference ? synced_cycles : std::min(next_event(), cycles);
+        if (event > synced_cycles)
+            skip(event - synced_cycles);
+        if (synced_cycles < cycles)
+            step();
+    }
+    schedule_sync();
+}
+
+void APU::schedule_sync() {
+    next_sync = std::min(synced_cycles + (next_frame_counter_step() - frame_counter_cycle - 1), next_dmc_fetch());
+}
@@ -0,0 +1,43 @@
+#include "audio_output.h"
+
+AudioOutput::AudioOutput(int requested_rate) : ring(RING_CAPACITY) {
+    SDL_AudioSpec desired = {}, obtained = {};
+    desired.freq = requested_rate;
+    desired.format = AUDIO_S16SYS;
+    desired.channels = 1;
+    desired.samples = 512;
+    desired.callback = callback;
+    desired.userdata = this;
+
+    device = SDL_OpenAudioDevice(nullptr, 0, &desired, &obtained, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+    if (!device) {
+        LOG_WARN("could not open audio device: %s", SDL_GetError());
+        return;
+    }
+
+    sample_rate = obtained.freq;
+    SDL_PauseAudioDevice(device, 0);
+}
+
+AudioOutput::~AudioOutput() {
+    if (device)
+        SDL_CloseAudioDevice(device);
+}
+
+void AudioOutput::callback(void *userdata, Uint8 *stream, int len) {
+    auto output = static_cast<AudioOutput *>(userdata);
+    auto samples = reinterpret_cast<int16 *>(stream);
+    size_t count = len / sizeof(int16);
+
+    size_t popped = output->ring.pop(samples, count);
+    if (popped < count) {
+        std::fill(samples + popped, samples + count, 0);
+        output->underruns++;
+    }
+    output->samples_played += count;
+}
+
+void AudioOutput::push(const int16 *samples, int count) {
+    if (ring.push(samples, count) < static_cast<size_t>(count))
+        overruns++;
+}
@@ -0,0 +1,97 @@
+#include "blip_buffer.h"
+
+#include <cmath>
+#include <cstring>
+
+BlipBuffer::BlipBuffer(double clock_rate, double sample_rate, int max_samples, Quality quality) {
+    // relative to the output's Nyquist frequency; longer kernels have a sharper transition band to spend
+    double cutoff;
+    switch (quality) {
+
+    case Quality::Low:
+        kernel_width = 8;
+        cutoff = 0.8;
+        break;
+    case Quality::Medium:
+        kernel_width = 16;
+        cutoff = 0.9;
+        break;
+    case Quality::High:
+        kernel_width = 32;
+        cutoff = 0.95;
+        break;
+    default:
+        UNREACHABLE("unknown quality %d", static_cast<int>(quality));
+
+    }
+    ASSERT(kernel_width % LANES == 0, "kernel width %d isn't a multiple of %d", kernel_width, LANES);
+
+    buffer.resize(max_samples + kernel_width);
+    kernel.resize(PHASES * kernel_width);
+    set_rates(clock_rate, sample_rate);
+
+    // windowed sinc impulses, one for every fractional position, each summing to exactly 1 << DELTA_BITS so that a
+    // step always settles at its full height
+    std::vector<double> taps(kernel_width);
+    for (int phase = 0; phase < PHASES; phase++) {
+        double center = kernel_width / 2 - 1 + static_cast<double>(phase) / PHASES;
+        double sum = 0;
+
+        for (int i = 0; i < kernel_width; i++) {
+            double x = i - center;
+            double sinc = x == 0 ? 1 : std::sin(M_PI * cutoff * x) / (M_PI * cutoff * x);
+            double window = 0.42 + 0.5 * std::cos(2 * M_PI * x / kernel_width)
+                            + 0.08 * std::cos(4 * M_PI * x / kernel_width); // Blackman
+            taps[i] = std::abs(x) < kernel_width / 2 ? sinc * window : 0;
+            sum += taps[i];
+        }
+
+        int32 *row = &kernel[phase * kernel_width];
+        int total = 0;
+        for (int i = 0; i < kernel_width; i++) {
+            row[i] = static_cast<int32>(std::lround(taps[i] / sum * (1 << DELTA_BITS)));
+            total += row[i];
+        }
+        row[kernel_width / 2] += (1 << DELTA_BITS) - total; // rounding error
+    }
+}
+
+void BlipBuffer::set_rates(double clock_rate, double sample_rate) {
+    factor = static_cast<uint64>(std::ceil(sample_rate / clock_rate * 4294967296.0));
+}
+
+void BlipBuffer::end_frame(uint32 duration) {
+    offset += duration * factor;
+    ASSERT(samples_available() <= capacity(), "blip buffer overflowed (%d samples)", samples_available());
+}
+
+uint32 BlipBuffer::clocks_until_full() const {
+    uint64 room = (static_cast<uint64>(capacity()) << 32) - offset;
+    return static_cast<uint32>(std::min<uint64>(room / factor, UINT32_MAX));
+}
+
+int BlipBuffer::read_samples(int16 *out, int count) {
+    count = std::min(count, samples_available());
+    // everything past the last impulse's tail is still zero
+    int used = std::min(samples_available() + kernel_width + 1, static_cast<int>(buffer.size()));
+
+    for (int i = 0; i < count; i++) {
+        integrator += buffer[i];
+        int32 sample = integrator >> DELTA_BITS;
+        out[i] = static_cast<int16>(std::clamp(sample, -32768, 32767));
+        integrator -= sample * (1 << (DELTA_BITS - BASS_SHIFT));
+    }
+
+    // shift what's left (including the tails of impulses past the last complete sample) to the front
+    int remaining = used - count;
+    std::memmove(buffer.data(), buffer.data() + count, remaining * sizeof(int32));
+    std::fill(buffer.begin() + remaining, buffer.begin() + used, 0);
+    offset -= static_cast<uint64>(count) << 32;
+    return count;
+}
+
+void BlipBuffer::clear() {
+    std::fill(buffer.begin(), buffer.end(), 0);
+    offset = 0;
+    integrator = 0;
+}
@@ -0,0 +1,51 @@
+#include "boot_cache.h"
+
+#include <cstdio>
+#include <memory>
+#include <string>
+
+#include "format.h"
+#include "save_state.h"
+
+namespace {
+    std::string snapshot_path(const char *directory, uint64 rom_hash, int frames) {
+        return string_printf("%s/%016llx-%d-v%u.%u.state", directory, (unsigned long long) rom_hash, frames,
+                             boot_cache::VERSION, MachineState::VERSION);
+    }
+
+    bool exists(const std::string &path) {
+        FILE *file = fopen(path.c_str(), "rb");
+        if (file)
+            fclose(file);
+        return file != nullptr;
+    }
+}
+
+bool boot_cache::boot(Bus &bus, const char *directory, int frames) {
+    ASSERT(frames >= 0, "%d frames", frames);
+    uint64 rom_hash = bus.cartridge.rom_hash();
+    std::string path = snapshot_path(directory, rom_hash, frames);
+    auto state = std::make_unique<MachineState>();
+
+    // a snapshot that doesn't load (e.g. a truncated file) is made again, and replaced
+    bool cached = exists(path) && save_state::read(path.c_str(), *state, rom_hash);
+    if (!cached) {
+        bus.reset();
+        bus.controller[0] = bus.controller[1] = 0;
+        {
+            // the APU has caught up and nothing is left to be heard when the state is taken
+            ReplaySettings settings(bus);
+            for (int frame = 0; frame < frames; frame++)
+                bus.execute_one_frame();
+        }
+        bus.save_state(*state);
+        if (save_state::write(path.c_str(), *state, rom_hash))
+            LOG_INFO("saved the state %d frames after power-on to %s", frames, path.c_str());
+    }
+
+    // loaded in both cases, so the bus doesn't depend on whether it was a hit, e.g. in how the PPU skipped drawing
+    bus.load_state(*state);
+    if (bus.ppu.render_interval > 0)
+        bus.ppu.draw_next_frame();
+    return cached;
+}
@@ -1,15 +1,32 @@
 #include "bus.h"
 
+#include <cstring>
+
+#include "hash.h"
+
 void Bus::write(uint16 addr, uint8 data) {
     LOG_TRACE("[$%04x] <- %02x", addr, data);
     if (cartridge.cpu_write(addr, data)) {
-        // TODO
+        // mapper registers live in cartridge space, so this is the only place the mirroring can change
+        if (cartridge.mirroring != ppu.mirroring())
+            ppu.update_mirroring();
+        ppu.record_event(PPUEvent::CartridgeWrite, addr, data);
     } else if (addr >= RAM_START && addr <= RAM_END) {
         ram[addr & 0x7ff] = data;
     } else if (addr >= PPU_START && addr <= PPU_END) {
         ppu.cpu_write(addr & 0x7, data);
-    } else if (addr >= CONTROLLER_START && addr <= CONTROLLER_END) {
-        controller_saved_state[addr & 1] = controller[addr & 1];
+    } else if (addr == OAM_DMA) {
+        // https://www.nesdev.org/wiki/PPU_registers#OAMDMA
+        // the whole page is copied at once, the cpu is then suspended for as long as the transfer would take
+        for (int i = 0; i < 256; i++)
+            ppu.cpu_write(4, read((data << 8) | i));
+        dma_cycles = 513 + ((system_clock / 3) & 1);
+    } else if ((addr >= APU_START && addr <= APU_END) || addr == APU_STATUS || addr == APU_FRAME_COUNTER) {
+        apu.cpu_write(addr, data);
+    } else if (addr == CONTROLLER_START) {
+        // the strobe latches both controllers; $4017 writes go to the APU's frame counter
+        controller_saved_state[0] = controller[0];
+        controller_saved_state[1] = controller[1];
     }
 }
 
@@ -23,6 +40,8 @@ uint8 Bus::read(uint16 addr) {
         data = ram[addr & 0x7ff];
     } else if (addr >= PPU_START && addr <= PPU_END) {
         data = ppu.cpu_read(addr & 0x7);
+    } else if (addr == APU_STATUS) {
+        data = apu.cpu_read(addr);
     } else if (addr >= CONTROLLER_START && addr <= CONTROLLER_END) {
         data = !!(controller_saved_state[addr & 1] & 0x80);
         controller_saved_state[addr & 1] <<= 1;
@@ -36,7 +55,15 @@ void Bus::clock() {
     bool nmi_requested = false;
     ppu.clock(nmi_requested);
     if (system_clock % 3 == 0) { // cpu clocks at 1/3rd the rate of the ppu
-        cpu.clock(*this);
+        apu.clock();
+        if (dma_cycles > 0) {
+            dma_cycles--;
+        } else {
+            cpu.clock(*this);
+            // the IRQ line is level triggered and only checked between instructions
+            if (cpu.cycles == 0 && apu.irq_pending())
+                cpu.irq(*this);
+        }
     }
 
     if (nmi_requested) {
@@ -46,12 +73,19 @@ void Bus::clock() {
     system_clock++;
 }
 
+void Bus::hit_breakpoint() {
+    if (!probing_breakpoints)
+        throw BreakpointException{};
+    last_breakpoint_clock = system_clock;
+}
+
 void Bus::reset() {
     bool saved_breakpoints_enabled = breakpoints_enabled;
     breakpoints_enabled = false;
     defer { breakpoints_enabled = saved_breakpoints_enabled; };
 
     cpu.reset(*this);
+    apu.reset();
 }
 
 void Bus::execute_one_instruction() {
@@ -65,3 +99,44 @@ void Bus::execute_one_frame() {
     while (!ppu.finished_frame)
         clock();
 }
+
+void Bus::save_state(MachineState &state) const {
+    std::memcpy(&state.bus, static_cast<const BusState *>(this), sizeof(BusState));
+    std::memcpy(&state.cpu, static_cast<const R6502State *>(&cpu), sizeof(R6502State));
+    std::memcpy(&state.ppu, static_cast<const PPUState *>(&ppu), sizeof(PPUState));
+    std::memcpy(&state.apu, static_cast<const APUState *>(&apu), sizeof(APUState));
+    state.mirroring = cartridge.mirroring;
+    std::memset(state.mapper, 0, sizeof(state.mapper));
+    cartridge.save_state(state.mapper);
+}
+
+std::unique_ptr<Bus> Bus::fork() const {
+    MachineState state;
+    save_state(state);
+    return fork(state);
+}
+
+std::unique_ptr<Bus> Bus::fork(const MachineState &state) const {
+    auto child = std::make_unique<Bus>(cartridge.clone());
+    child->load_state(state);
+    child->controller[0] = controller[0];
+    child->controller[1] = controller[1];
+    child->ppu.render_interval = ppu.render_interval;
+    return child;
+}
+
+uint64 Bus::state_hash() {
+    apu.sync();
+    auto state = std::make_unique<MachineState>();
+    save_state(*state);
+    return fnv1a(state.get(), sizeof(MachineState));
+}
+
+void Bus::load_state(const MachineState &state) {
+    std::memcpy(static_cast<BusState *>(this), &state.bus, sizeof(BusState));
+    std::memcpy(static_cast<R6502State *>(&cpu), &state.cpu, sizeof(R6502State));
+    cartridge.mirroring = state.mirroring;
+    cartridge.load_state(state.mapper);
+    ppu.load_state(state.ppu);
+    apu.load_state(state.apu);
+}
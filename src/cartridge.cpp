@@ -1,6 +1,9 @@
 #include "cartridge.h"
 
 #include <fstream>
+#include <utility>
+
+#include "hash.h"
 
 Cartridge Cartridge::load_cartridge(const char *file) {
     // https://www.nesdev.org/wiki/INES
@@ -45,15 +48,30 @@ Cartridge Cartridge::load_cartridge(const char *file) {
     }
 
     Cartridge cartridge(header.prg_size, header.chr_size, std::move(mapper));
+    if (header.flags6 & 0x8)
+        cartridge.mirroring = Mirroring::FourScreen;
+    else if (header.flags6 & 0x1)
+        cartridge.mirroring = Mirroring::Vertical;
+    else
+        cartridge.mirroring = Mirroring::Horizontal;
+
     in.read(reinterpret_cast<char *>(cartridge.prg.data()), cartridge.prg.size());
     in.read(reinterpret_cast<char *>(cartridge.chr.data()), cartridge.chr.size());
     return cartridge;
 }
 
+Cartridge Cartridge::clone() const {
+    return Cartridge(*this, mapper->clone());
+}
+
+uint64 Cartridge::rom_hash() const {
+    return fnv1a(chr.data(), chr.size(), fnv1a(prg.data(), prg.size()));
+}
+
 std::optional<uint8> Cartridge::cpu_read(uint16 addr) {
     auto mapped = mapper->map_cpu_read(addr);
     if (mapped.has_value())
-        return prg[*mapped];
+        return std::as_const(prg)[*mapped];
     else
         return {};
 }
@@ -61,22 +79,24 @@ std::optional<uint8> Cartridge::cpu_read(uint16 addr) {
 std::optional<uint8> Cartridge::ppu_read(uint16 addr) {
     auto mapped = mapper->map_ppu_read(addr);
     if (mapped.has_value())
-        return chr[*mapped];
+        return std::as_const(chr)[*mapped];
     else
         return {};
 }
 
 bool Cartridge::cpu_write(uint16 addr, uint8 val) {
-    auto mapped = mapper->map_cpu_read(addr);
+    auto mapped = mapper->map_cpu_write(addr);
     if (mapped.has_value()) {
         prg[*mapped] = val;
+        if (auto m = mapper->mirroring(); m.has_value())
+            mirroring = *m;
         return true;
     } else
         return false;
 }
 
 bool Cartridge::ppu_write(uint16 addr, uint8 val) {
-    auto mapped = mapper->map_ppu_read(addr);
+    auto mapped = mapper->map_ppu_write(addr);
     if (mapped.has_value()) {
         chr[*mapped] = val;
         return true;
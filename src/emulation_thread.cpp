@@ -0,0 +1,449 @@
+#include "emulation_thread.h"
+
+#include <chrono>
+#include <ctime>
+
+namespace {
+    constexpr int FAST_FORWARD_FRAMES = 8; // frames emulated per update while fast forwarding, only the last is drawn
+    constexpr const char *QUICK_SAVE_FILE = "quicksave.state";
+    constexpr const char *MOVIE_FILE = "movie.nesm";
+#ifdef __EMSCRIPTEN__
+    constexpr bool REWIND_THREADED = false; // no threads without -pthread
+#else
+    constexpr bool REWIND_THREADED = true;
+#endif
+}
+
+EmulationThread::EmulationThread(Bus &bus, AudioOutput &audio)
+        : bus(bus), audio(audio), rewind(REWIND_BUDGET, 60, REWIND_THREADED),
+          timeline(TIMELINE_KEYFRAME_INTERVAL, TIMELINE_KEYFRAMES),
+          rewind_state(std::make_unique<MachineState>()), run_ahead_state(std::make_unique<MachineState>()),
+          power_on_state(std::make_unique<MachineState>()), commands(COMMAND_CAPACITY) {
+    bus.save_state(*power_on_state);
+    if (audio.is_open())
+        pacer.set_external_clock([&audio] { return audio.played_seconds(); });
+    publish_snapshot();
+}
+
+EmulationThread::~EmulationThread() {
+    alive.store(false, std::memory_order_release);
+    if (worker.joinable())
+        worker.join();
+    stop_movie(); // so a recording still in progress is saved
+}
+
+void EmulationThread::start() {
+    worker = std::thread(&EmulationThread::run, this);
+}
+
+void EmulationThread::start_netplay(std::unique_ptr<Transport> transport, int player, int input_delay) {
+    render_thread.reset();
+    restore(*power_on_state);
+    netplay_transport = std::move(transport);
+    netplay = std::make_unique<Rollback>(bus, *netplay_transport, player, input_delay);
+    running = true;
+    LOG_INFO("netplay started as player %d", player + 1);
+}
+
+void EmulationThread::run() {
+    while (alive.load(std::memory_order_acquire)) {
+        pacer.wait();
+        update();
+    }
+}
+
+void EmulationThread::send(Command command) {
+    if (!commands.push(command))
+        LOG_WARN("emulation thread is behind, dropped command %d", static_cast<int>(command));
+}
+
+const EmulatorSnapshot &EmulationThread::latest_snapshot() {
+    snapshots.update();
+    return snapshots.read_buffer();
+}
+
+void EmulationThread::update() {
+    Command command;
+    while (commands.pop(command))
+        execute(command);
+
+    bool rewound = false;
+
+    uint16 pads = input.load(std::memory_order_relaxed);
+    bus.controller[0] = pads & 0xff;
+    bus.controller[1] = pads >> 8;
+    bus.breakpoints_enabled = running && breakpoints_enabled && !netplay;
+
+    ran_ahead = false;
+    if (netplay && !running) {
+        netplay->poll();
+    } else if (running) {
+        try {
+            if (netplay) {
+                bus.ppu.render_interval = 1;
+                netplay->advance(pads & 0xff); // always from controller 1's keys, whichever port it goes to
+            } else if (rewinding.load(std::memory_order_relaxed)) {
+                rewind_frame();
+                rewound = true;
+            } else {
+                int frames_to_run = fast_forward.load(std::memory_order_relaxed) ? FAST_FORWARD_FRAMES : 1;
+                int ahead = std::clamp(run_ahead.load(std::memory_order_relaxed), 0, MAX_RUN_AHEAD);
+                // with run-ahead the real frames are never shown, so they don't need to be drawn
+                run_frames(frames_to_run, ahead == 0);
+                if (ahead > 0)
+                    run_ahead_frames(ahead);
+            }
+        } catch (const BreakpointException &e) {
+            running = false;
+            bus.breakpoints_enabled = false;
+            timeline.record_interruption(bus);
+        }
+    }
+    rewound_last_update = rewound;
+
+    if (audio.is_open()) {
+        int16 samples[1024];
+        int count;
+        while ((count = bus.apu.read_samples(samples, 1024)) > 0) {
+            // playing frames backwards just sounds like noise, but the audio clock has to keep going for the pacer
+            if (running && rewinding.load(std::memory_order_relaxed))
+                std::fill(samples, samples + count, 0);
+            audio.push(samples, count);
+            if (capture)
+                capture->push(samples, count);
+        }
+        bus.apu.set_rate_adjustment(audio.rate_adjustment());
+    }
+
+    publish_snapshot();
+}
+
+void EmulationThread::execute(Command command) {
+    rewound_last_update = false; // whatever the command does, rewinding starts over after it
+    if (netplay) {
+        switch (command) {
+        case Command::ToggleRunning:
+        case Command::ToggleBreakpoints:
+        case Command::ToggleCapture:
+        case Command::SaveState:
+            break;
+        default:
+            LOG_WARN("command %d isn't available during netplay", static_cast<int>(command));
+            return;
+        }
+    }
+
+    switch (command) {
+
+    case Command::Clock:
+    case Command::Step:
+    case Command::Frame:
+        if (running)
+            break;
+        bus.breakpoints_enabled = false; // no breakpoints in single-step mode
+        if (command == Command::Frame)
+            feed_input();
+        // running leaves drawing to run_frames, which decides frame by frame
+        bus.ppu.render_interval = 1;
+        if (!render_thread)
+            bus.ppu.draw_next_frame();
+        timeline.record(bus);
+        if (command == Command::Clock)
+            bus.clock();
+        else if (command == Command::Step)
+            bus.execute_one_instruction();
+        else
+            bus.execute_one_frame();
+        break;
+    case Command::StepBack:
+    case Command::ContinueBack:
+        if (!running)
+            step_back(command);
+        break;
+
+    case Command::Reset:
+        stop_movie();
+        timeline.clear();
+        bus.reset();
+        break;
+    case Command::ToggleRunning:
+        running = !running;
+        break;
+    case Command::ToggleBreakpoints:
+        breakpoints_enabled = !breakpoints_enabled;
+        break;
+    case Command::ToggleRenderThread:
+#ifndef __EMSCRIPTEN__ // no threads without -pthread
+        if (render_thread)
+            render_thread.reset();
+        else
+            render_thread = std::make_unique<RenderThread>(bus);
+#endif
+        break;
+    case Command::ToggleCapture:
+#ifndef __EMSCRIPTEN__
+        toggle_capture();
+#endif
+        break;
+    case Command::SaveState:
+        save_state();
+        break;
+    case Command::LoadState:
+        load_state();
+        break;
+    case Command::ToggleRecording:
+        toggle_recording();
+        break;
+    case Command::TogglePlayback:
+        toggle_playback();
+        break;
+    default:
+        UNREACHABLE("unknown command %d", static_cast<int>(command));
+
+    }
+}
+
+void EmulationThread::toggle_capture() {
+    if (capture) {
+        LOG_INFO("audio capture stopped after %llu samples (%llu dropped)",
+                 (unsigned long long) capture->samples_written.load(), (unsigned long long) capture->dropped.load());
+        capture.reset();
+        return;
+    }
+    if (!audio.is_open())
+        return;
+
+    char path[64];
+    std::time_t now = std::time(nullptr);
+    std::strftime(path, sizeof(path), "capture-%Y%m%d-%H%M%S.wav", std::localtime(&now));
+    capture = std::make_unique<WavWriter>(path, audio.sample_rate);
+    if (!capture->is_open())
+        capture.reset();
+    else
+        LOG_INFO("capturing audio to %s", path);
+}
+
+void EmulationThread::save_state() {
+    auto state = std::make_unique<MachineState>();
+    bus.save_state(*state);
+    if (save_state::write(QUICK_SAVE_FILE, *state, bus.cartridge.rom_hash()))
+        LOG_INFO("saved state to %s", QUICK_SAVE_FILE);
+}
+
+void EmulationThread::load_state() {
+    auto state = std::make_unique<MachineState>();
+    if (!save_state::read(QUICK_SAVE_FILE, *state, bus.cartridge.rom_hash()))
+        return;
+    restore(*state);
+    LOG_INFO("loaded state from %s", QUICK_SAVE_FILE);
+}
+
+void EmulationThread::restore(const MachineState &state) {
+    stop_movie();
+    timeline.clear();
+    load(state);
+}
+
+void EmulationThread::load(const MachineState &state) {
+    bus.load_state(state);
+    // states are taken between frames, and the one coming up may have been skipped by fast forward or run-ahead
+    bus.ppu.draw_next_frame();
+
+    // its PPU is a copy of the old one
+    if (render_thread)
+        render_thread->resync();
+}
+
+void EmulationThread::step_back(Command command) {
+    if (command == Command::ContinueBack && !breakpoints_enabled) {
+        LOG_WARN("breakpoints are off, there's nothing to continue back to");
+        return;
+    }
+
+    // its PPU replica would be left where the bus was
+    bool threaded = render_thread != nullptr;
+    render_thread.reset();
+    bool moved = command == Command::StepBack ? timeline.step_back(bus) : timeline.continue_back(bus);
+    if (threaded)
+        render_thread = std::make_unique<RenderThread>(bus);
+
+    auto stats = timeline.stats();
+    if (!moved) {
+        LOG_INFO("nothing to go back to in the last %.1f s of history", stats.seconds);
+        return;
+    }
+    stop_movie(); // from here it may go somewhere else than the movie did
+    LOG_INFO("went back to clock %llu in %.1f ms", (unsigned long long) bus.system_clock, stats.last_ms);
+}
+
+void EmulationThread::toggle_recording() {
+    if (recording) {
+        stop_movie();
+        return;
+    }
+
+    restore(*power_on_state);
+    recording = std::make_unique<Movie>();
+    recording->rom_hash = bus.cartridge.rom_hash();
+    LOG_INFO("recording a movie from power-on");
+}
+
+void EmulationThread::toggle_playback() {
+    if (playback) {
+        stop_movie();
+        return;
+    }
+
+    auto movie = std::make_unique<Movie>();
+    if (!movie::read(MOVIE_FILE, *movie))
+        return;
+    if (movie->rom_hash != 0 && movie->rom_hash != bus.cartridge.rom_hash()) {
+        LOG_WARN("%s was recorded on another ROM", MOVIE_FILE);
+        return;
+    }
+    restore(*power_on_state);
+    playback = std::move(movie);
+    playback_frame = 0;
+    LOG_INFO("playing back %s, %zu frames", MOVIE_FILE, playback->input.size());
+}
+
+void EmulationThread::stop_movie() {
+    if (recording) {
+        if (movie::write(MOVIE_FILE, *recording))
+            LOG_INFO("saved a movie of %zu frames to %s", recording->input.size(), MOVIE_FILE);
+        recording.reset();
+    }
+    if (playback) {
+        LOG_INFO("movie playback stopped after %zu of %zu frames", playback_frame, playback->input.size());
+        playback.reset();
+    }
+}
+
+void EmulationThread::feed_input() {
+    uint16 pads = input.load(std::memory_order_relaxed);
+    if (playback) {
+        if (playback_frame < playback->input.size())
+            pads = playback->input[playback_frame++];
+        else
+            stop_movie();
+    }
+    if (recording)
+        recording->input.push_back(pads);
+
+    bus.controller[0] = pads & 0xff;
+    bus.controller[1] = pads >> 8;
+}
+
+void EmulationThread::run_frames(int count, bool draw) {
+    // only the last frame is shown, any earlier one would be a picture of where the game was a few frames ago
+    bus.ppu.render_interval = 0;
+    for (int i = 0; i < count; i++) {
+        bus.save_state(*rewind_state);
+        rewind.push(*rewind_state);
+        feed_input();
+        timeline.record(bus);
+        // a render thread draws every frame it's sent on its own
+        if (draw && i == count - 1 && !render_thread)
+            bus.ppu.draw_next_frame();
+        bus.execute_one_frame();
+    }
+}
+
+void EmulationThread::rewind_frame() {
+    if (!rewind.pop(*rewind_state))
+        return;
+    if (!rewound_last_update) {
+        // only once, rather than for every frame it steps back
+        stop_movie();
+        timeline.clear();
+    }
+    load(*rewind_state);
+
+    // the state is from the start of a frame, running it once puts its picture on screen; that frame is
+    // already history, so it isn't pushed again
+    bus.ppu.render_interval = 1;
+    bus.breakpoints_enabled = false;
+    timeline.record(bus);
+    bus.execute_one_frame();
+}
+
+void EmulationThread::run_ahead_frames(int count) {
+    auto start = std::chrono::steady_clock::now();
+
+    RenderStats render_stats = bus.ppu.render_stats; // only counts the real frames
+    // drawn right here: the render thread's replica follows the real frames, so it mustn't see these
+    RenderThread *attached = bus.ppu.render_thread;
+    bus.ppu.render_thread = nullptr;
+    {
+        ReplaySettings settings(bus);
+        bus.save_state(*run_ahead_state);
+        for (int i = 0; i < count; i++) {
+            if (i == count - 1)
+                bus.ppu.draw_next_frame(); // whether a frame is drawn was already decided when the one before it ended
+            bus.execute_one_frame();
+        }
+    }
+
+    // the frame buffer isn't part of the state, so the last frame's picture stays in it
+    bus.load_state(*run_ahead_state);
+    bus.ppu.render_thread = attached;
+    bus.ppu.render_stats = render_stats;
+    ran_ahead = true;
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    run_ahead_ms += (ms - run_ahead_ms) * 0.05;
+}
+
+void EmulationThread::publish_snapshot() {
+    EmulatorSnapshot &snapshot = snapshots.write_buffer();
+    snapshot.sequence = ++snapshots_published;
+
+    const uint8 *frame;
+    if (render_thread && !ran_ahead) {
+        snapshot.render_stats = render_thread->stats();
+        frame = render_thread->acquire_frame();
+    } else {
+        frame = bus.ppu.frame_buffer();
+        snapshot.render_stats = bus.ppu.render_stats;
+    }
+    if (frame)
+        snapshot.frame.assign(frame, frame + SCREEN_WIDTH * SCREEN_HEIGHT);
+    else
+        snapshot.frame.clear();
+    if (render_thread && !ran_ahead)
+        render_thread->release_frame();
+
+    auto &cpu = bus.cpu;
+    snapshot.a = cpu.a;
+    snapshot.x = cpu.x;
+    snapshot.y = cpu.y;
+    snapshot.sp = cpu.sp;
+    snapshot.status = cpu.status;
+    snapshot.pc = cpu.pc;
+    snapshot.cycles = cpu.cycles;
+    snapshot.vram_addr = bus.ppu.vram_addr.value;
+    snapshot.ppu_data = bus.ppu.internal_read_buffer;
+
+    // straight from memory rather than through ppu_read, which could stop on a breakpoint
+    for (int i = 0; i < 32; i++)
+        snapshot.palettes[i] = bus.ppu.palette_mem[(i & 0x13) == 0x10 ? i & 0xf : i];
+    std::copy(std::begin(bus.ppu.name_table_mem[0]), std::end(bus.ppu.name_table_mem[0]), snapshot.nametable);
+    for (uint16 addr = 0; addr < 0x2000; addr++)
+        snapshot.pattern_tables[addr] = bus.cartridge.ppu_read(addr).value_or(0);
+
+    snapshot.pacing = pacer.stats();
+    snapshot.running = running;
+    snapshot.breakpoints_enabled = breakpoints_enabled;
+    snapshot.render_thread = render_thread != nullptr;
+    snapshot.capturing = capture != nullptr;
+    snapshot.recording_movie = recording != nullptr;
+    snapshot.playing_movie = playback != nullptr;
+    snapshot.netplay = netplay != nullptr;
+    if (netplay)
+        snapshot.netplay_stats = netplay->stats;
+    snapshot.rewind = rewind.stats();
+    snapshot.run_ahead = run_ahead.load(std::memory_order_relaxed);
+    snapshot.run_ahead_ms = snapshot.run_ahead > 0 ? run_ahead_ms : 0;
+
+    snapshots.publish();
+}
@@ -1,14 +1,72 @@
 #include "font.h"
 
-#include <fstream>
+#include <algorithm>
+#include <array>
 
-#include <nlohmann/json.hpp>
 #include <gfx.h>
+#include "font_bitmap.h" // generated by cmake/embed_font.cmake
 
-Font::Font(const char *bitmap_json) {
-    std::ifstream f(bitmap_json);
-    ASSERT(f.is_open(), "could not find '%s'", bitmap_json);
-    characters = nlohmann::json::parse(f);
+namespace {
+    constexpr int MAX_SPANS = (Font::TEXT_COLS + 1) / 2;
+
+    struct Span {
+        uint8 begin = 0, end = 0; // in unscaled columns
+    };
+
+    // each glyph row as the runs of set pixels in it
+    struct GlyphRow {
+        Span spans[MAX_SPANS] = {};
+        uint8 span_count = 0;
+    };
+
+    using GlyphTable = std::array<std::array<GlyphRow, Font::TEXT_ROWS>, 128>;
+
+    constexpr GlyphTable decode_glyphs() {
+        GlyphTable glyphs = {};
+        for (int c = 0; c < 128; c++) {
+            for (int row = 0; row < Font::TEXT_ROWS; row++) {
+                GlyphRow &glyph_row = glyphs[c][row];
+                for (int col = 0; col < Font::TEXT_COLS; col++) {
+                    if (!(FONT_BITMAP[c][row] & (1 << col)))
+                        continue;
+                    if (glyph_row.span_count && glyph_row.spans[glyph_row.span_count - 1].end == col)
+                        glyph_row.spans[glyph_row.span_count - 1].end++;
+                    else
+                        glyph_row.spans[glyph_row.span_count++] = {static_cast<uint8>(col), static_cast<uint8>(col + 1)};
+                }
+            }
+        }
+        return glyphs;
+    }
+
+    constexpr GlyphTable glyphs = decode_glyphs();
+}
+
+const Font::Atlas &Font::atlas_for(const SDL_PixelFormat *format, SDL_Color color, int scale) const {
+    uint32 pixel = SDL_MapRGB(format, color.r, color.g, color.b);
+    for (auto &atlas : atlases) {
+        if (atlas.format == format->format && atlas.pixel == pixel && atlas.scale == scale)
+            return atlas;
+    }
+
+    Atlas &atlas = atlases.emplace_back();
+    atlas.format = format->format;
+    atlas.pixel = pixel;
+    atlas.scale = scale;
+
+    int width = TEXT_COLS * scale;
+    int height = TEXT_ROWS * scale;
+    atlas.pixels.assign(GLYPHS * height * width, 0);
+    for (int c = 0; c < GLYPHS; c++) {
+        for (int y = 0; y < height; y++) {
+            uint32 *row = &atlas.pixels[(c * height + y) * width];
+            for (int i = 0; i < glyphs[c][y / scale].span_count; i++) {
+                const Span &span = glyphs[c][y / scale].spans[i];
+                std::fill(row + span.begin * scale, row + span.end * scale, pixel);
+            }
+        }
+    }
+    return atlas;
 }
 
 SDL_Surface *Font::render_text(std::string_view text, SDL_Color color, int scale) const {
@@ -19,6 +77,11 @@ SDL_Surface *Font::render_text(std::string_view text, SDL_Color color, int scale
 }
 
 void Font::render_to_surface(SDL_Surface *surface, int x, int y, std::string_view text, SDL_Color color, int scale) const {
+    ASSERT(surface->format->BytesPerPixel == 4, "expected a 32-bit surface");
+    const Atlas &atlas = atlas_for(surface->format, color, scale);
+    int width = TEXT_COLS * scale;
+    int height = TEXT_ROWS * scale;
+
     SDL_LockSurface(surface);
 
     int xadvance = 0;
@@ -30,22 +93,26 @@ void Font::render_to_surface(SDL_Surface *surface, int x, int y, std::string_vie
             continue;
         }
 
-        auto s = std::string(1, c);
-        auto it = characters.find(s);
-        ASSERT(it != characters.end(), "unexpected character or string '%s'", s.c_str());
-
-        auto &rows = it->second;
-        for (int row = 0; row < TEXT_ROWS; row++) {
-            for (int col = 0; col < TEXT_COLS; col++) {
-
-                for (int pixel_y = 0; pixel_y < scale; pixel_y++) {
-                    for (int pixel_x = 0; pixel_x < scale; pixel_x++) {
-                        int bit = rows[row] & (1 << col);
-                        int tx = (xadvance + col) * scale + pixel_x + x;
-                        int ty = (yadvance + row) * scale + pixel_y + y;
-                        if (bit && tx >= 0 && ty >= 0 && tx < surface->w && ty < surface->h)
-                            gfx::set_pixel(surface, tx, ty, color);
-                    }
+        auto glyph = static_cast<uint8>(c);
+        ASSERT(glyph < GLYPHS && FONT_HAS_GLYPH[glyph], "unexpected character '%c'", c);
+
+        int gx = xadvance * scale + x;
+        int gy = yadvance * scale + y;
+        for (int glyph_row = 0; glyph_row < TEXT_ROWS; glyph_row++) {
+            const GlyphRow &row_spans = glyphs[glyph][glyph_row];
+            for (int i = 0; i < row_spans.span_count; i++) {
+                int begin = std::max(row_spans.spans[i].begin * scale, -gx);
+                int end = std::min(row_spans.spans[i].end * scale, surface->w - gx);
+                if (begin >= end)
+                    continue;
+
+                // the same span on every row this glyph row is scaled to
+                int first_row = std::max(glyph_row * scale, -gy);
+                int last_row = std::min((glyph_row + 1) * scale, surface->h - gy);
+                for (int row = first_row; row < last_row; row++) {
+                    auto dst = reinterpret_cast<uint32 *>(static_cast<uint8 *>(surface->pixels) + (gy + row) * surface->pitch) + gx;
+                    const uint32 *src = &atlas.pixels[(glyph * height + row) * width];
+                    std::copy(src + begin, src + end, dst + begin);
                 }
             }
         }
@@ -0,0 +1,87 @@
+#include "fork_pool.h"
+
+#include "hash.h"
+
+namespace {
+    void run_job(ForkPool::Job &job) {
+        Bus &bus = *job.bus;
+        for (uint16 pads : job.input) {
+            bus.controller[0] = pads & 0xff;
+            bus.controller[1] = pads >> 8;
+            bus.execute_one_frame();
+        }
+
+        const uint8 *frame = bus.ppu.frame_buffer();
+        job.picture_hash = frame ? fnv1a(frame, SCREEN_WIDTH * SCREEN_HEIGHT) : 0;
+        job.ram = bus.ram;
+        job.state_hash = bus.state_hash();
+    }
+}
+
+ForkPool::ForkPool(int threads) {
+    if (threads <= 0)
+        threads = static_cast<int>(std::max(std::thread::hardware_concurrency(), 1u));
+    for (int i = 1; i < threads; i++)
+        workers.emplace_back(&ForkPool::work, this);
+}
+
+ForkPool::~ForkPool() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    work_ready.notify_all();
+    for (auto &worker : workers)
+        worker.join();
+}
+
+void ForkPool::run(std::vector<Job> &to_run) {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        jobs = &to_run;
+        next_job = 0;
+        jobs_finished = 0;
+        generation++;
+    }
+    work_ready.notify_all();
+
+    size_t done = take_jobs(to_run);
+    std::unique_lock<std::mutex> guard(lock);
+    jobs_finished += done;
+    work_done.wait(guard, [&] { return jobs_finished == to_run.size() && workers_busy == 0; });
+    jobs = nullptr;
+}
+
+void ForkPool::work() {
+    uint64 seen = 0;
+    for (;;) {
+        std::vector<Job> *to_run;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            work_ready.wait(guard, [&] { return stopping || generation != seen; });
+            if (stopping)
+                return;
+            seen = generation;
+            // woken too late, the run is already over
+            if (!jobs)
+                continue;
+            to_run = jobs;
+            workers_busy++;
+        }
+
+        size_t done = take_jobs(*to_run);
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            jobs_finished += done;
+            workers_busy--;
+        }
+        work_done.notify_one();
+    }
+}
+
+size_t ForkPool::take_jobs(std::vector<Job> &to_run) {
+    size_t done = 0;
+    for (size_t i; (i = next_job.fetch_add(1, std::memory_order_relaxed)) < to_run.size(); done++)
+        run_job(to_run[i]);
+    return done;
+}
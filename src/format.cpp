@@ -6,10 +6,10 @@ std::string string_printf(const char *fmt, ...) {
     va_list ap1, ap2;
 
     va_start(ap1, fmt);
+    va_copy(ap2, ap1); // copied before the first vsnprintf uses ap1 up
     int n = vsnprintf(nullptr, 0, fmt, ap1);
 
     std::string str(n, '\0');
-    va_copy(ap2, ap1);
     vsnprintf(str.data(), n+1, fmt, ap2); // vsnprintf will write the null terminator into str[n]
     va_end(ap2);
     va_end(ap1);
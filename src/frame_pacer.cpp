@@ -0,0 +1,121 @@
+#include "frame_pacer.h"
+
+#include <cmath>
+#include <thread>
+
+namespace {
+    double seconds(std::chrono::steady_clock::duration d) {
+        return std::chrono::duration<double>(d).count();
+    }
+}
+
+void FramePacer::set_external_clock(std::function<double()> clock) {
+    external_clock = std::move(clock);
+    have_reference = false;
+    clock_ratio = 1;
+}
+
+void FramePacer::reset() {
+    next_frame = {};
+    last_frame = {};
+}
+
+void FramePacer::wait() {
+    auto now = Clock::now();
+    update_clock_ratio(now);
+    auto period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1 / (frame_rate * clock_ratio)));
+
+    if (next_frame == Clock::time_point{} || now > next_frame + MAX_LATE_FRAMES * period) {
+        // first frame, or so far behind (paused, stuck in the debugger...) that catching up would just be a burst of
+        // frames as fast as possible
+        if (next_frame != Clock::time_point{})
+            late_frames++;
+        next_frame = now + period;
+        last_frame = {};
+        record_interval(now);
+        return;
+    }
+
+    if (now > next_frame) {
+        // a bit late, the next ones come sooner to keep the average
+        late_frames++;
+    } else {
+        auto sleep_until = next_frame - spin;
+        if (now < sleep_until) {
+            std::this_thread::sleep_until(sleep_until);
+            // wake up early enough to absorb how late sleeps typically are; the occasional much later one isn't worth
+            // spinning for every frame
+            auto overshoot = Clock::now() - sleep_until;
+            oversleep += (overshoot - oversleep) / 8;
+            spin = std::clamp<Clock::duration>(2 * oversleep, MIN_SPIN, MAX_SPIN);
+        }
+        while (Clock::now() < next_frame)
+            std::this_thread::yield();
+        now = Clock::now();
+    }
+
+    next_frame += period;
+    record_interval(now);
+}
+
+void FramePacer::update_clock_ratio(Clock::time_point now) {
+    if (!external_clock)
+        return;
+
+    ClockPoint point = {now, external_clock()};
+    if (!have_reference) {
+        reference = next_reference = point;
+        have_reference = true;
+        return;
+    }
+
+    double wall = seconds(now - reference.wall);
+    if (wall >= DRIFT_WARMUP) {
+        double ratio = (point.external - reference.external) / wall;
+        if (std::abs(ratio - 1) > MAX_DRIFT) {
+            // the clock stopped or jumped (device paused or reopened...), measure again from here
+            LOG_WARN("external clock ran at %.3fx the wall clock, ignoring it", ratio);
+            reference = next_reference = point;
+            clock_ratio = 1;
+            return;
+        }
+        clock_ratio = ratio;
+    }
+
+    // keep the window long enough that the clock's step size doesn't matter, but not so long it can't follow changes
+    if (seconds(now - next_reference.wall) >= DRIFT_WINDOW) {
+        reference = next_reference;
+        next_reference = point;
+    }
+}
+
+void FramePacer::record_interval(Clock::time_point now) {
+    if (last_frame != Clock::time_point{}) {
+        intervals[next_interval] = std::chrono::duration<double, std::milli>(now - last_frame).count();
+        next_interval = (next_interval + 1) % JITTER_WINDOW;
+        interval_count = std::min(interval_count + 1, JITTER_WINDOW);
+    }
+    last_frame = now;
+}
+
+FramePacer::Stats FramePacer::stats() const {
+    Stats stats = {};
+    stats.target_ms = 1000 / (frame_rate * clock_ratio);
+    stats.late_frames = late_frames;
+    stats.clock_ratio = clock_ratio;
+    if (interval_count == 0)
+        return stats;
+
+    double sum = 0;
+    for (int i = 0; i < interval_count; i++)
+        sum += intervals[i];
+    stats.mean_ms = sum / interval_count;
+
+    double variance = 0;
+    for (int i = 0; i < interval_count; i++) {
+        variance += (intervals[i] - stats.mean_ms) * (intervals[i] - stats.mean_ms);
+        stats.worst_ms = std::max(stats.worst_ms, std::abs(intervals[i] - stats.target_ms));
+    }
+    stats.jitter_ms = std::sqrt(variance / interval_count);
+    return stats;
+}
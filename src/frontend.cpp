@@ -1,6 +1,7 @@
 #include <SDL2/SDL.h>
 
 #include <sstream>
+#include <cstring>
 #include <memory>
 
 #define LOAD_DYNAMICALLY 0      // we want to see typechecking on the declared functions
@@ -10,22 +11,33 @@
 #include "format.h"
 #include "r6502.h"
 #include "gfx.h"
+#include "palette.h"
 
 namespace {
     constexpr int VIEWPORT_WIDTH = 1400;
     constexpr int VIEWPORT_HEIGHT = 800;
 
-    constexpr int NES_WIDTH = 256;
-    constexpr int NES_HEIGHT = 240;
-}
+    constexpr int GAME_SCALE = 3;
+    constexpr SDL_Rect GAME_RECT = {5, 5, SCREEN_WIDTH * GAME_SCALE, SCREEN_HEIGHT * GAME_SCALE};
+    constexpr int NAMETABLE_CELL = 12; // a two digit tile id at font scale 1, scaled up with the game
 
-NesFrontend::NesFrontend() : font("monogram-bitmap.json"), bus("roms/donkeykong.nes") {
-    Font::the_font() = font;
+    constexpr const char *PALETTE_FILE = "palette.pal"; // used instead of the built-in palette if it exists
+    // PLAYER:LOCAL_PORT:PEER_HOST:PEER_PORT[:INPUT_DELAY] starts a netplay session, e.g. 1:7000:10.0.0.2:7001 on one
+    // machine and 2:7001:10.0.0.1:7000 on the other
+    constexpr const char *NETPLAY_ENV = "NES_NETPLAY";
 
-    if (SDL_Init(SDL_INIT_VIDEO) < 0) {
+    constexpr int AUDIO_SAMPLE_RATE = 48000;
+    constexpr auto AUDIO_QUALITY = BlipBuffer::Quality::Medium;
+}
+
+NesFrontend::NesFrontend() : bus("roms/donkeykong.nes") {
+    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) < 0) {
         panic("could not init SDL");
     }
 
+    audio = std::make_unique<AudioOutput>(AUDIO_SAMPLE_RATE);
+    bus.apu.set_sample_rate(audio->sample_rate, AUDIO_QUALITY);
+
     // SDL bug: moving the window to the other monitor freezes the program
     // but if I position the window there to begin with, it works
     // since I want to develop on my 2nd monitor this hack works well for now
@@ -44,20 +56,46 @@ NesFrontend::NesFrontend() : font("monogram-bitmap.json"), bus("roms/donkeykong.
         panic("could not create window");
     }
 
-    window_surface = SDL_GetWindowSurface(window);
-    ASSERT(window_surface, "expected window surface");
+    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "nearest"); // the game is only ever scaled by whole numbers
+    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+    if (!renderer) {
+        LOG_WARN("no accelerated renderer (%s), falling back to software", SDL_GetError());
+        renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_SOFTWARE);
+    }
+    if (!renderer) {
+        panic("could not create renderer");
+    }
 
-    selected_palette_surface = gfx::create_surface(20, 8);
-    SDL_LockSurface(selected_palette_surface);
-    for (int y = 0; y < 8; y++) {
-        for (int x = 0; x < 20; x++) {
-            gfx::set_pixel(selected_palette_surface, x, y, SDL_Color{127, 127, 127});
-        }
+    screen_texture = gfx::create_texture(renderer, SCREEN_WIDTH, SCREEN_HEIGHT);
+    help_panel = std::make_unique<Panel>(renderer, font, SDL_Rect{780, 0, 320, 485});
+    registers_panel = std::make_unique<Panel>(renderer, font, SDL_Rect{1100, 0, 300, 125});
+    stats_panel = std::make_unique<Panel>(renderer, font, SDL_Rect{1100, 125, 300, 125});
+    disassembly_panel = std::make_unique<Panel>(renderer, font, SDL_Rect{1100, 250, 300, 425});
+    redraws_panel = std::make_unique<Panel>(renderer, font, SDL_Rect{780, 735, 620, 30});
+    nametable_surface = gfx::create_surface(32 * NAMETABLE_CELL, 30 * NAMETABLE_CELL);
+    nametable_texture = gfx::create_texture(renderer, nametable_surface->w, nametable_surface->h);
+    for (int i = 0; i < 2; i++) {
+        pattern_table_surfaces[i] = gfx::create_surface(128, 128);
+        pattern_table_textures[i] = gfx::create_texture(renderer, 128, 128);
     }
-    SDL_UnlockSurface(selected_palette_surface);
+    palettes_surface = gfx::create_surface(16, 8 * 4); // the 8 palettes one below the other
+    palettes_texture = gfx::create_texture(renderer, 16, 8 * 4);
+
+    if (auto loaded = load_palette(PALETTE_FILE)) {
+        system_palette = *loaded;
+        palette_rgb = pack_palette(system_palette);
+        LOG_INFO("using the palette in %s", PALETTE_FILE);
+    }
+
+    SDL_DisplayMode display_mode;
+    if (SDL_GetCurrentDisplayMode(SDL_GetWindowDisplayIndex(window), &display_mode) == 0 && display_mode.refresh_rate > 0)
+        pacer = FramePacer(display_mode.refresh_rate);
 
     init_cpu();
-    disassembly = R6502::disassemble(bus, 0x0000, 0xfff0);
+    // only the cartridge's PRG, where the code is: reading the rest would be slower and also trigger the side effects
+    // of reading the PPU's and APU's registers, e.g. moving the PPU's VRAM address before the game even started.
+    // Stops short of the interrupt vectors, and of wrapping around the end of the address space
+    disassembly = R6502::disassemble(bus, 0x8000, 0xfff9);
 
     last_time = SDL_GetPerformanceCounter();
 
@@ -65,10 +103,41 @@ NesFrontend::NesFrontend() : font("monogram-bitmap.json"), bus("roms/donkeykong.
         bus.ppu.address_write_breakpoints.push_back(i);
     }
 
+    // from here on only the emulation thread touches the bus
+    emulation = std::make_unique<EmulationThread>(bus, *audio);
+#ifndef __EMSCRIPTEN__
+    if (const char *netplay = getenv(NETPLAY_ENV)) {
+        int player, local_port, peer_port, input_delay = 0;
+        char peer_host[256];
+        if (sscanf(netplay, "%d:%d:%255[^:]:%d:%d", &player, &local_port, peer_host, &peer_port, &input_delay) >= 4
+            && (player == 1 || player == 2)) {
+            auto transport = std::make_unique<UdpTransport>(local_port, peer_host, peer_port);
+            if (transport->is_open())
+                emulation->start_netplay(std::move(transport), player - 1, input_delay);
+        } else {
+            LOG_WARN("%s should be PLAYER:LOCAL_PORT:PEER_HOST:PEER_PORT[:INPUT_DELAY]", NETPLAY_ENV);
+        }
+    }
+    emulation->start();
+#endif
+
     LOG_INFO("Frontend initialized successfully.");
 }
 
 NesFrontend::~NesFrontend() {
+    emulation.reset();
+    audio.reset();
+    for (auto panel : {&help_panel, &registers_panel, &stats_panel, &disassembly_panel, &redraws_panel})
+        panel->reset();
+    for (auto texture : {screen_texture, nametable_texture, palettes_texture})
+        SDL_DestroyTexture(texture);
+    for (auto surface : {nametable_surface, palettes_surface})
+        SDL_FreeSurface(surface);
+    for (int i = 0; i < 2; i++) {
+        SDL_DestroyTexture(pattern_table_textures[i]);
+        SDL_FreeSurface(pattern_table_surfaces[i]);
+    }
+    SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     SDL_Quit();
 }
@@ -78,21 +147,18 @@ void NesFrontend::init_cpu() {
 }
 
 bool NesFrontend::update() {
+#ifndef __EMSCRIPTEN__ // the browser already calls us once per display refresh
+    pacer.wait();
+#endif
+
     uint64 now = SDL_GetPerformanceCounter();
     float delta = (float) (now-last_time) / (float) SDL_GetPerformanceFrequency();
     last_time = now;
 
-    bus.breakpoints_enabled = full_speed && breakpoints_enabled;
-
-    if (full_speed) {
-        try {
-            // TODO: timing so it goes at 60 Hz
-            bus.execute_one_frame();
-        } catch (const BreakpointException &e) {
-            full_speed = false;
-            bus.breakpoints_enabled = false;
-        }
-    }
+#ifdef __EMSCRIPTEN__
+    emulation->update();
+#endif
+    const EmulatorSnapshot &snapshot = emulation->latest_snapshot();
 
     frames++;
     frame_time += delta;
@@ -102,59 +168,52 @@ bool NesFrontend::update() {
         frames = 0;
     }
 
-    SDL_FillRect(window_surface, nullptr, 0);
+    if (snapshot.sequence != drawn_sequence) {
+        render_screen(snapshot.frame.empty() ? nullptr : snapshot.frame.data());
+        drawn_sequence = snapshot.sequence;
+    }
+    update_debug_views(snapshot);
 
-    render_cpu();
+    render_panels(snapshot);
 
-    constexpr int GAME_SCALE = 3;
-    auto screen = bus.ppu.render_screen();
-    auto pattern0 = bus.ppu.render_pattern_table(0, current_palette);
-    auto pattern1 = bus.ppu.render_pattern_table(1, current_palette);
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+    SDL_RenderClear(renderer);
 
-    SDL_Rect dst = {5, 5, screen->w*GAME_SCALE, screen->h*GAME_SCALE};
-    SDL_BlitScaled(screen, nullptr, window_surface, &dst);
+    for (auto panel : {help_panel.get(), registers_panel.get(), stats_panel.get(), disassembly_panel.get(), redraws_panel.get()})
+        panel->present(renderer);
+    SDL_RenderCopy(renderer, screen_texture, nullptr, &GAME_RECT);
 
-    auto render_nametable_values = [&]() {
+    if (visualization == ScreenVisualization::NametableID) {
+        SDL_RenderCopy(renderer, nametable_texture, nullptr, &GAME_RECT);
+    } else if (visualization != ScreenVisualization::Display) {
+        auto patterns = pattern_table_textures[visualization == ScreenVisualization::Patterns0 ? 0 : 1];
         for (int y = 0; y < 30; y++) {
             for (int x = 0; x < 32; x++) {
-                uint8 id = bus.ppu.name_table_mem[0][y * 32 + x];
-                dst = {x * 24 + 5, y * 24 + 5, 24, 24};
-
-                if (visualization == ScreenVisualization::NametableID) {
-                    char buf[3];
-                    snprintf(buf, 3, "%02X", id);
-                    auto text = Font::the_font().render_text(buf, SDL_Color{255, 255, 255}, 2);
-                    SDL_BlitSurface(text, nullptr, window_surface, &dst);
-                    SDL_FreeSurface(text);
-                } else {
-                    SDL_Rect src = {(id & 0xf) << 3, ((id >> 4) & 0xf) << 3, 8, 8};
-                    SDL_BlitScaled(visualization == ScreenVisualization::Patterns0 ? pattern0 : pattern1,
-                                   &src, window_surface, &dst);
-                }
+                uint8 id = snapshot.nametable[y * 32 + x];
+                SDL_Rect src = {(id & 0xf) << 3, ((id >> 4) & 0xf) << 3, 8, 8};
+                SDL_Rect dst = {x * 24 + 5, y * 24 + 5, 24, 24};
+                SDL_RenderCopy(renderer, patterns, &src, &dst);
             }
         }
-    };
-
-    if (visualization != ScreenVisualization::Display) {
-        render_nametable_values();
     }
 
-    dst = {780, 597, pattern0->w, pattern0->h};
-    SDL_BlitSurface(pattern0, nullptr, window_surface, &dst);
+    SDL_Rect dst = {780, 597, 128, 128};
+    SDL_RenderCopy(renderer, pattern_table_textures[0], nullptr, &dst);
 
-    dst = {910, 597, pattern1->w, pattern1->h};
-    SDL_BlitSurface(pattern1, nullptr, window_surface, &dst);
+    dst = {910, 597, 128, 128};
+    SDL_RenderCopy(renderer, pattern_table_textures[1], nullptr, &dst);
 
-    dst = {780+current_palette*20-2, 589-2, selected_palette_surface->w, selected_palette_surface->h};
-    SDL_BlitSurface(selected_palette_surface, nullptr, window_surface, &dst);
+    dst = {780+current_palette*20-2, 589-2, 20, 8};
+    SDL_SetRenderDrawColor(renderer, 127, 127, 127, 255);
+    SDL_RenderFillRect(renderer, &dst);
 
     for (int i = 0; i < 8; i++) {
-        auto palette = bus.ppu.render_palette(i);
-        dst = {780+i*20, 589, palette->w, palette->h};
-        SDL_BlitSurface(palette, nullptr, window_surface, &dst);
+        SDL_Rect src = {0, i * 4, 16, 4};
+        dst = {780+i*20, 589, 16, 4};
+        SDL_RenderCopy(renderer, palettes_texture, &src, &dst);
     }
 
-    SDL_UpdateWindowSurface(window);
+    SDL_RenderPresent(renderer);
 
     auto key_to_controller_bit = [](SDL_Keycode keycode) {
         switch (keycode) {
@@ -179,35 +238,56 @@ bool NesFrontend::update() {
             return true;
 
         case SDL_KEYUP:
-            bus.controller[0] &= ~key_to_controller_bit(event.key.keysym.sym);
+            emulation->input &= ~key_to_controller_bit(event.key.keysym.sym);
+            if (event.key.keysym.sym == SDLK_TAB)
+                emulation->fast_forward = false;
+            else if (event.key.keysym.sym == SDLK_BACKSPACE)
+                emulation->rewinding = false;
             break;
 
         case SDL_KEYDOWN:
-            bus.controller[0] |= key_to_controller_bit(event.key.keysym.sym);
-
-            if (!full_speed) {
-                ASSERT(!bus.breakpoints_enabled, "no breakpoints in single-step mode");
-                if (event.key.keysym.sym == SDLK_c) {
-                    bus.clock();
-                } else if (event.key.keysym.sym == SDLK_n) {
-                    bus.execute_one_instruction();
-                } else if (event.key.keysym.sym == SDLK_f) {
-                    bus.execute_one_frame();
-                }
+            emulation->input |= key_to_controller_bit(event.key.keysym.sym);
+
+            // stepping is ignored while running
+            bool shift = event.key.keysym.mod & KMOD_SHIFT;
+            if (event.key.keysym.sym == SDLK_c) {
+                emulation->send(EmulationThread::Command::Clock);
+            } else if (event.key.keysym.sym == SDLK_n) {
+                emulation->send(shift ? EmulationThread::Command::StepBack : EmulationThread::Command::Step);
+            } else if (event.key.keysym.sym == SDLK_f) {
+                emulation->send(EmulationThread::Command::Frame);
             }
 
             if (event.key.keysym.sym == SDLK_ESCAPE) {
                 return true;
             } else if (event.key.keysym.sym == SDLK_SPACE) {
-                full_speed = !full_speed;
+                emulation->send(shift ? EmulationThread::Command::ContinueBack : EmulationThread::Command::ToggleRunning);
+            } else if (event.key.keysym.sym == SDLK_TAB) {
+                emulation->fast_forward = true;
+            } else if (event.key.keysym.sym == SDLK_BACKSPACE) {
+                emulation->rewinding = true;
+            } else if (event.key.keysym.sym == SDLK_m) {
+                emulation->send(EmulationThread::Command::ToggleRecording);
+            } else if (event.key.keysym.sym == SDLK_o) {
+                emulation->send(EmulationThread::Command::TogglePlayback);
+            } else if (event.key.keysym.sym == SDLK_l) {
+                emulation->run_ahead = (emulation->run_ahead + 1) % (EmulationThread::MAX_RUN_AHEAD + 1);
             } else if (event.key.keysym.sym == SDLK_r) {
-                bus.reset();
+                emulation->send(EmulationThread::Command::Reset);
             } else if (event.key.keysym.sym == SDLK_p) {
                 current_palette = (current_palette+1) % 8;
             } else if (event.key.keysym.sym == SDLK_v) {
                 ++visualization;
             } else if (event.key.keysym.sym == SDLK_b) {
-                breakpoints_enabled = !breakpoints_enabled;
+                emulation->send(EmulationThread::Command::ToggleBreakpoints);
+            } else if (event.key.keysym.sym == SDLK_t) {
+                emulation->send(EmulationThread::Command::ToggleRenderThread);
+            } else if (event.key.keysym.sym == SDLK_w) {
+                emulation->send(EmulationThread::Command::ToggleCapture);
+            } else if (event.key.keysym.sym == SDLK_F5) {
+                emulation->send(EmulationThread::Command::SaveState);
+            } else if (event.key.keysym.sym == SDLK_F8) {
+                emulation->send(EmulationThread::Command::LoadState);
             }
             break;
         }
@@ -216,68 +296,203 @@ bool NesFrontend::update() {
     return false;
 }
 
-void NesFrontend::render_text(int x, int y, std::string_view text, SDL_Color color) const {
-    font.render_to_surface(window_surface, x, y, text, color);
+void NesFrontend::render_screen(const uint8 *frame) {
+    void *pixels;
+    int pitch;
+    if (SDL_LockTexture(screen_texture, nullptr, &pixels, &pitch) < 0)
+        return;
+    for (int y = 0; y < SCREEN_HEIGHT; y++) {
+        auto row = reinterpret_cast<uint32 *>(static_cast<uint8 *>(pixels) + y * pitch);
+        for (int x = 0; x < SCREEN_WIDTH; x++)
+            row[x] = frame ? palette_rgb[frame[y * SCREEN_WIDTH + x]] : 0;
+    }
+    SDL_UnlockTexture(screen_texture);
 }
 
-void NesFrontend::render_cpu() {
-    auto &cpu = bus.cpu;
-    auto status = status_to_string(cpu.status);
+void NesFrontend::update_debug_views(const EmulatorSnapshot &snapshot) {
+    bool palettes_changed = !debug_views_drawn || memcmp(snapshot.palettes, drawn_palettes, sizeof(drawn_palettes)) != 0;
+    bool patterns_changed = !debug_views_drawn || current_palette != drawn_palette ||
+                            memcmp(snapshot.pattern_tables, drawn_pattern_tables, sizeof(drawn_pattern_tables)) != 0;
 
-    constexpr int TEXT_START = 1100;
-    // render cpu status
-    render_text(TEXT_START, 5,
-                string_printf("Status = %02x = %s", cpu.status, status.c_str()));
+    if (palettes_changed)
+        render_palettes(snapshot);
+    if (palettes_changed || patterns_changed) {
+        render_pattern_table(snapshot, 0, current_palette);
+        render_pattern_table(snapshot, 1, current_palette);
+    }
+    memcpy(drawn_palettes, snapshot.palettes, sizeof(drawn_palettes));
+    memcpy(drawn_pattern_tables, snapshot.pattern_tables, sizeof(drawn_pattern_tables));
+    drawn_palette = current_palette;
+    debug_views_drawn = true;
+
+    // only needed while it's shown
+    if (visualization == ScreenVisualization::NametableID &&
+        (!nametable_drawn || memcmp(snapshot.nametable, drawn_nametable, sizeof(drawn_nametable)) != 0)) {
+        render_nametable(snapshot);
+        memcpy(drawn_nametable, snapshot.nametable, sizeof(drawn_nametable));
+        nametable_drawn = true;
+    }
+}
+
+void NesFrontend::render_nametable(const EmulatorSnapshot &snapshot) {
+    SDL_FillRect(nametable_surface, nullptr, 0);
+    for (int y = 0; y < 30; y++) {
+        for (int x = 0; x < 32; x++) {
+            char buf[3];
+            snprintf(buf, 3, "%02X", snapshot.nametable[y * 32 + x]);
+            font.render_to_surface(nametable_surface, x * NAMETABLE_CELL, y * NAMETABLE_CELL, buf, white, 1);
+        }
+    }
+    gfx::upload(nametable_texture, nametable_surface);
+}
 
-    render_text(TEXT_START, 25,
-                string_printf("A = %02x, X = %02x, Y = %02x", cpu.a, cpu.x, cpu.y));
+void NesFrontend::render_pattern_table(const EmulatorSnapshot &snapshot, int table, uint8 palette) {
+    SDL_Surface *surface = pattern_table_surfaces[table];
+    SDL_LockSurface(surface);
 
-    render_text(TEXT_START, 45,
-                string_printf("SP = %02x, PC = %04x", cpu.sp, cpu.pc));
+    for (int y = 0; y < 16; y++) {
+        for (int x = 0; x < 16; x++) {
+            int tile_index = y * 16 + x;
 
-    render_text(TEXT_START, 65,
-                string_printf("Cycles = %d", cpu.cycles));
+            for (int row = 0; row < 8; row++) {
+                uint8 tile_lsb = snapshot.pattern_tables[table * 0x1000 + tile_index * 16 + row];
+                uint8 tile_msb = snapshot.pattern_tables[table * 0x1000 + tile_index * 16 + row + 8];
 
-    render_text(TEXT_START, 85,
-                string_printf("PPU addr = $%04x", bus.ppu.vram_addr.value));
+                for (int col = 0; col < 8; col++) {
+                    int shift = 7-col;
+                    int bit = 1 << shift; // most-significant bit is left-most pixel
+                    uint8 pixel = ((tile_lsb & bit) >> shift) + ((tile_msb & bit) >> shift);
 
-    render_text(TEXT_START, 105,
-                string_printf("PPU data = $%02x", bus.ppu.internal_read_buffer));
+                    int pixel_x = x * 8 + col;
+                    int pixel_y = y * 8 + row;
+                    auto color = color_from_palette(snapshot, palette, pixel);
+                    gfx::set_pixel(surface, pixel_x, pixel_y, color);
+                }
+            }
+        }
+    }
+
+    SDL_UnlockSurface(surface);
+    gfx::upload(pattern_table_textures[table], surface);
+}
+
+void NesFrontend::render_palettes(const EmulatorSnapshot &snapshot) {
+    SDL_LockSurface(palettes_surface);
+    for (int palette = 0; palette < 8; palette++) {
+        for (int y = 0; y < 4; y++) {
+            for (int x = 0; x < 16; x++) {
+                int color_index = x / 4;
+                auto color = color_from_palette(snapshot, (uint8) palette, (uint8) color_index);
+                gfx::set_pixel(palettes_surface, x, palette * 4 + y, color);
+            }
+        }
+    }
+    SDL_UnlockSurface(palettes_surface);
+    gfx::upload(palettes_texture, palettes_surface);
+}
+
+SDL_Color NesFrontend::color_from_palette(const EmulatorSnapshot &snapshot, uint8 palette, uint8 pixel) {
+    uint8 index = snapshot.palettes[(palette << 2) + pixel];
+    auto color = system_palette[index % 64];
+    return {color.r, color.g, color.b, 255};
+}
+
+void NesFrontend::render_panels(const EmulatorSnapshot &snapshot) {
+    auto &cpu = snapshot;
+
+    constexpr int TEXT_START = 1100;
+    // render cpu status
+    if (registers_panel->changed(cpu.status, cpu.a, cpu.x, cpu.y, cpu.sp, cpu.pc, cpu.cycles, snapshot.vram_addr,
+                                 snapshot.ppu_data)) {
+        auto status = status_to_string(cpu.status);
+        registers_panel->text(TEXT_START, 5, string_printf("Status = %02x = %s", cpu.status, status.c_str()), white);
+        registers_panel->text(TEXT_START, 25, string_printf("A = %02x, X = %02x, Y = %02x", cpu.a, cpu.x, cpu.y), white);
+        registers_panel->text(TEXT_START, 45, string_printf("SP = %02x, PC = %04x", cpu.sp, cpu.pc), white);
+        registers_panel->text(TEXT_START, 65, string_printf("Cycles = %d", cpu.cycles), white);
+        registers_panel->text(TEXT_START, 85, string_printf("PPU addr = $%04x", snapshot.vram_addr), white);
+        registers_panel->text(TEXT_START, 105, string_printf("PPU data = $%02x", snapshot.ppu_data), white);
+    }
+
+    auto &stats = snapshot.render_stats;
+    auto &pacing = snapshot.pacing;
+    uint64 underruns = audio->underruns.load();
+    auto &rewind = snapshot.rewind;
+    if (stats_panel->changed(stats.fast_frames, stats.precise_frames, stats.fallback_frames, underruns, pacing.mean_ms,
+                             pacing.jitter_ms, rewind.frames, rewind.bytes, snapshot.run_ahead_ms, snapshot.netplay,
+                             snapshot.netplay_stats)) {
+        stats_panel->text(TEXT_START, 125, string_printf("Fast = %llu, dot = %llu", (unsigned long long) stats.fast_frames,
+                                                         (unsigned long long) stats.precise_frames), white);
+        stats_panel->text(TEXT_START, 145, string_printf("Fallbacks = %llu, underruns = %llu",
+                                                         (unsigned long long) stats.fallback_frames,
+                                                         (unsigned long long) underruns), white);
+        stats_panel->text(TEXT_START, 165, string_printf("Frame = %.2f ms, jitter = %.2f ms", pacing.mean_ms,
+                                                         pacing.jitter_ms), white);
+        stats_panel->text(TEXT_START, 185, string_printf("Rewind = %.1f s in %.2f MB", rewind.frames / 60.0,
+                                                         rewind.bytes / (1024.0 * 1024.0)), white);
+        stats_panel->text(TEXT_START, 205, string_printf("Run-ahead = %.2f ms/frame (%.0f%%)", snapshot.run_ahead_ms,
+                                                         100 * snapshot.run_ahead_ms / pacing.target_ms), white);
+        auto &netplay = snapshot.netplay_stats;
+        if (snapshot.netplay) {
+            stats_panel->text(TEXT_START, 225, string_printf("Ping = %.0f ms, rollbacks = %llu, max = %llu",
+                                                             netplay.ping_ms, (unsigned long long) netplay.rollbacks,
+                                                             (unsigned long long) netplay.max_depth), white);
+        } else {
+            stats_panel->text(TEXT_START, 225, "Netplay = OFF", white);
+        }
+    }
 
     // render instructions
-    int y = 0;
-    render_text(780, 5+(y++)*20, "C = clock once");
-    render_text(780, 5+(y++)*20, "N = step once");
-    render_text(780, 5+(y++)*20, "F = render once");
-    render_text(780, 5+(y++)*20, "SPACE = start/stop");
-    render_text(780, 5+(y++)*20, "R = reset");
-    render_text(780, 5+(y++)*20, "P = change palette");
-    render_text(780, 5+(y++)*20, "V = change visualization");
-    switch (visualization) {
-
-    case ScreenVisualization::Display:
-        render_text(780, 5+(y++)*20, "  (current = display)");
-        break;
-    case ScreenVisualization::NametableID:
-        render_text(780, 5+(y++)*20, "  (current = nametable)");
-        break;
-    case ScreenVisualization::Patterns0:
-        render_text(780, 5+(y++)*20, "  (current = pattern 0)");
-        break;
-    case ScreenVisualization::Patterns1:
-        render_text(780, 5+(y++)*20, "  (current = pattern 1)");
-        break;
+    if (help_panel->changed(visualization, snapshot.breakpoints_enabled, snapshot.render_thread, snapshot.capturing,
+                            snapshot.run_ahead, snapshot.recording_movie, snapshot.playing_movie)) {
+        int y = 0;
+        auto line = [&](std::string_view text) { help_panel->text(780, 5+(y++)*20, text, white); };
+        line("C = clock once");
+        line("N = step once");
+        line("F = render once");
+        line("SHIFT+N/SPACE = step/run back");
+        line("SPACE = start/stop");
+        line("TAB = fast forward (hold)");
+        line("BACKSPACE = rewind (hold)");
+        line("R = reset");
+        line("P = change palette");
+        line("V = change visualization");
+        switch (visualization) {
+
+        case ScreenVisualization::Display:
+            line("  (current = display)");
+            break;
+        case ScreenVisualization::NametableID:
+            line("  (current = nametable)");
+            break;
+        case ScreenVisualization::Patterns0:
+            line("  (current = pattern 0)");
+            break;
+        case ScreenVisualization::Patterns1:
+            line("  (current = pattern 1)");
+            break;
+        }
+        line("B = toggle breakpoints");
+        line(snapshot.breakpoints_enabled ? "  (current = ON)" : "  (current = OFF)");
+        line("T = toggle render thread");
+        line(snapshot.render_thread ? "  (current = ON)" : "  (current = OFF)");
+        line("W = toggle audio capture");
+        line(snapshot.capturing ? "  (current = ON)" : "  (current = OFF)");
+        line("F5/F8 = save/load state");
+        line("M = record movie from power-on");
+        line(snapshot.recording_movie ? "  (current = ON)" : "  (current = OFF)");
+        line("O = play back movie");
+        line(snapshot.playing_movie ? "  (current = ON)" : "  (current = OFF)");
+        line("L = change run-ahead frames");
+        line(string_printf("  (current = %d)", snapshot.run_ahead));
     }
-    render_text(780, 5+(y++)*20, "B = toggle breakpoints");
-    render_text(780, 5+(y++)*20, string_printf("  (current = %s)", breakpoints_enabled ? "ON" : "OFF"));
 
     // render disassembly
     auto render_disassembly = [&](int y) {
         auto current_instruction = disassembly.find(cpu.pc);
         if (current_instruction == disassembly.end()) {
-            render_text(TEXT_START, y, "???");
-            render_text(TEXT_START, y+20, "Could not find:");
-            render_text(TEXT_START, y+40, "  disassembly[pc]");
+            disassembly_panel->text(TEXT_START, y, "???", white);
+            disassembly_panel->text(TEXT_START, y+20, "Could not find:", white);
+            disassembly_panel->text(TEXT_START, y+40, "  disassembly[pc]", white);
             return;
         }
 
@@ -287,11 +502,11 @@ void NesFrontend::render_cpu() {
             if (prev == disassembly.begin())
                 break;
             --prev;
-            render_text(TEXT_START, y + (9-i)*20, string_printf("$%04x: %s", prev->first, prev->second.c_str()), white);
+            disassembly_panel->text(TEXT_START, y + (9-i)*20, string_printf("$%04x: %s", prev->first, prev->second.c_str()), white);
         }
 
         // render the current instruction
-        render_text(TEXT_START, y + 10*20, string_printf("$%04x: %s", current_instruction->first, current_instruction->second.c_str()), red);
+        disassembly_panel->text(TEXT_START, y + 10*20, string_printf("$%04x: %s", current_instruction->first, current_instruction->second.c_str()), red);
 
         // render the next 10 instructions
         auto next = current_instruction;
@@ -299,25 +514,20 @@ void NesFrontend::render_cpu() {
             ++next;
             if (next == disassembly.end())
                 break;
-            render_text(TEXT_START, y + (i+11)*20, string_printf("$%04x: %s", next->first, next->second.c_str()), white);
-        }
-    };
-    render_disassembly(170);
-
-    auto render_memory = [&](uint16 start_addr, const char *name, int x, int y) {
-        render_text(x, y, name);
-        for (int mem_y = 0; mem_y < 16; mem_y++) {
-            uint16 addr = (mem_y << 4) + start_addr;
-            std::string row = string_printf("$%04x: ", addr);
-            row.reserve(row.capacity() + 16 * 3); // we want space for 16 words, plus the space in between them
-            for (int mem_x = 0; mem_x < 16; mem_x++) {
-                row += string_printf("%02x ", bus.read(addr));
-                addr++;
-            }
-
-            render_text(x, mem_y * 20 + y + 20, row);
+            disassembly_panel->text(TEXT_START, y + (i+11)*20, string_printf("$%04x: %s", next->first, next->second.c_str()), white);
         }
     };
+    if (disassembly_panel->changed(cpu.pc))
+        render_disassembly(250);
+
+    if (redraws_panel->changed(help_panel->redraws, registers_panel->redraws, stats_panel->redraws,
+                               disassembly_panel->redraws)) {
+        redraws_panel->text(780, 740, string_printf("Redraws: help %llu, cpu %llu, stats %llu, code %llu",
+                                                    (unsigned long long) help_panel->redraws,
+                                                    (unsigned long long) registers_panel->redraws,
+                                                    (unsigned long long) stats_panel->redraws,
+                                                    (unsigned long long) disassembly_panel->redraws), white);
+    }
 }
 
 extern "C" {
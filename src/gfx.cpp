@@ -1,7 +1,7 @@
 #include "gfx.h"
 
 SDL_Surface *gfx::create_surface(int w, int h) {
-    SDL_Surface *surface = SDL_CreateRGBSurface(0, w, h, 32, 0, 0, 0, 0);
+    SDL_Surface *surface = SDL_CreateRGBSurfaceWithFormat(0, w, h, 32, PIXEL_FORMAT);
     ASSERT(surface, "expected surface");
     return surface;
 }
@@ -19,3 +19,13 @@ void gfx::set_pixel(SDL_Surface *surface, int x, int y, SDL_Color color) {
     uint32 rgb = SDL_MapRGB(surface->format, color.r, color.g, color.b);
     *pixel = rgb;
 }
+
+SDL_Texture *gfx::create_texture(SDL_Renderer *renderer, int w, int h) {
+    SDL_Texture *texture = SDL_CreateTexture(renderer, PIXEL_FORMAT, SDL_TEXTUREACCESS_STREAMING, w, h);
+    ASSERT(texture, "could not create texture: %s", SDL_GetError());
+    return texture;
+}
+
+void gfx::upload(SDL_Texture *texture, SDL_Surface *surface) {
+    SDL_UpdateTexture(texture, nullptr, surface->pixels, surface->pitch);
+}
@@ -0,0 +1,324 @@
+// Runs a ROM without any UI, driven by a movie, and reports how fast it went and hashes of where it ended up. The
+// same ROM, movie and options always do exactly the same work, so benchmark numbers are comparable between builds,
+// and the hashes catch changes in behavior.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+#include "boot_cache.h"
+#include "bus.h"
+#include "fork_pool.h"
+#include "frame_pacer.h"
+#include "hash.h"
+#include "movie.h"
+#include "netplay.h"
+#include "state_store.h"
+
+namespace {
+    void usage() {
+        fprintf(stderr, "usage: nes_headless ROM MOVIE [--frames N] [--no-video] [--audio RATE] [--export FILE]\n");
+        fprintf(stderr, "                    [--boot N] [--boot-cache DIR] [--netplay LATENCY]\n");
+        fprintf(stderr, "                    [--store] [--verify N] [--threads N]\n");
+        fprintf(stderr, "  MOVIE and FILE are FM2 if they end in .fm2, our own format otherwise\n");
+        fprintf(stderr, "  --frames N    run N frames, with no buttons down past the movie's end (default: its length)\n");
+        fprintf(stderr, "  --no-video    only produce the PPU's timing, don't draw\n");
+        fprintf(stderr, "  --audio RATE  synthesize audio at RATE Hz (default: off)\n");
+        fprintf(stderr, "  --export FILE also write the movie to FILE, e.g. to convert it\n");
+        fprintf(stderr, "  --boot N      start N frames after power-on, which the movie can't press anything in\n");
+        fprintf(stderr, "  --boot-cache DIR\n");
+        fprintf(stderr, "                where the states to --boot from are kept, made on first use (default: .)\n");
+        fprintf(stderr, "  --netplay LATENCY\n");
+        fprintf(stderr, "                play the movie as two rollback netplay sessions, one per controller, over a\n");
+        fprintf(stderr, "                simulated link with LATENCY ms one way, and check they end up where a plain run does\n");
+        fprintf(stderr, "  --store       keep the state before every frame in a StateStore, report how well it shares\n");
+        fprintf(stderr, "                pages between them, and check every state comes back out the same\n");
+        fprintf(stderr, "  --verify N    check the movie plays back deterministically: run it once keeping a state every N\n");
+        fprintf(stderr, "                frames, then run every N-frame segment again from its state, in parallel, and\n");
+        fprintf(stderr, "                compare where each ends up with the next state\n");
+        fprintf(stderr, "  --threads N   for --verify, 0 for one per hardware thread (default: 0)\n");
+        exit(2);
+    }
+
+    bool is_fm2(const char *path) {
+        std::string_view name = path;
+        return name.size() >= 4 && name.substr(name.size() - 4) == ".fm2";
+    }
+
+    uint16 movie_input(const Movie &movie, long frame) {
+        return static_cast<size_t>(frame) < movie.input.size() ? movie.input[frame] : 0;
+    }
+
+    /// Both sides run on a virtual clock of one tick per frame, so the result doesn't depend on how fast this machine is.
+    int run_netplay(const char *rom_path, const Movie &movie, long frames, bool video, double latency_ms) {
+        Bus plain(rom_path);
+        plain.reset();
+        plain.ppu.render_interval = 0;
+        for (long frame = 0; frame < frames; frame++) {
+            uint16 pads = movie_input(movie, frame);
+            plain.controller[0] = pads & 0xff;
+            plain.controller[1] = pads >> 8;
+            plain.execute_one_frame();
+        }
+        auto state = std::make_unique<MachineState>();
+        plain.save_state(*state);
+        uint64 expected = state_checksum(*state);
+
+        uint64 tick = 0;
+        auto clock = [&] { return tick / NTSC_FRAME_RATE; };
+        LoopbackLink link(latency_ms / 1000, latency_ms / 4000, 0.01);
+        link.clock = clock;
+        std::unique_ptr<Bus> buses[2];
+        std::unique_ptr<Rollback> sessions[2];
+        for (int side = 0; side < 2; side++) {
+            buses[side] = std::make_unique<Bus>(rom_path);
+            buses[side]->reset();
+            buses[side]->ppu.render_interval = video ? 1 : 0;
+            sessions[side] = std::make_unique<Rollback>(*buses[side], link.endpoint(side), side);
+            sessions[side]->clock = clock;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        auto done = [&](int side) { return sessions[side]->confirmed_checksum(frames).has_value(); };
+        for (; !done(0) || !done(1); tick++) {
+            // a session that stops advancing never confirms anything again, so a stall is a bug
+            if (tick > 2 * static_cast<uint64>(frames) + 600) {
+                fprintf(stderr, "the sessions stalled at frames %u and %u\n", sessions[0]->frame(),
+                        sessions[1]->frame());
+                return 1;
+            }
+            for (int side = 0; side < 2; side++) {
+                uint16 pads = movie_input(movie, sessions[side]->frame());
+                sessions[side]->advance(side == 0 ? pads & 0xff : pads >> 8);
+            }
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        printf("%ld frames over %.0f ms latency in %llu ticks, %.3f s\n", frames, latency_ms,
+               (unsigned long long) tick, seconds);
+        bool synced = true;
+        for (int side = 0; side < 2; side++) {
+            auto &stats = sessions[side]->stats;
+            uint64 checksum = *sessions[side]->confirmed_checksum(frames);
+            synced = synced && checksum == expected && stats.desyncs == 0;
+            printf("player %d: %llu rollbacks, %llu frames run again, max %llu, %llu waits, %llu desyncs, ping %.0f ms, "
+                   "checksum %016llx\n", side + 1, (unsigned long long) stats.rollbacks,
+                   (unsigned long long) stats.resimulated_frames, (unsigned long long) stats.max_depth,
+                   (unsigned long long) stats.waits, (unsigned long long) stats.desyncs, stats.ping_ms,
+                   (unsigned long long) checksum);
+        }
+        printf("plain run checksum %016llx: %s\n", (unsigned long long) expected, synced ? "in sync" : "DESYNCED");
+        return synced ? 0 : 1;
+    }
+
+    /// Only what the game can see: the PPU's part of the state also says how frames were drawn, and the APU's how far
+    /// its channels lag behind, both of which depend on the options.
+    uint64 visible_state_hash(Bus &bus) {
+        bus.apu.sync();
+        auto state = std::make_unique<MachineState>();
+        bus.save_state(*state);
+        uint64 hash = fnv1a(&state->bus, sizeof(state->bus));
+        hash = fnv1a(&state->cpu, sizeof(state->cpu), hash);
+        hash = fnv1a(&state->apu, sizeof(state->apu), hash);
+        hash = fnv1a(state->ppu.name_table_mem, sizeof(state->ppu.name_table_mem), hash);
+        hash = fnv1a(state->ppu.palette_mem, sizeof(state->ppu.palette_mem), hash);
+        return fnv1a(state->ppu.oam_mem, sizeof(state->ppu.oam_mem), hash);
+    }
+
+    /// The first pass is serial, and keeps a state and its hash at the start of every segment; the second runs every
+    /// segment again on a ForkPool, each from its own state, which is where the time goes for a long movie.
+    int run_verify(Bus &bus, const Movie &movie, long frames, long segment_frames, int threads) {
+        bus.ppu.render_interval = 0;
+        long segments = (frames + segment_frames - 1) / segment_frames;
+        std::vector<std::unique_ptr<MachineState>> keyframes;
+        std::vector<uint64> hashes; // at the start of every segment, and at the end of the last one
+
+        auto start = std::chrono::steady_clock::now();
+        for (long frame = 0; frame < frames; frame++) {
+            if (frame % segment_frames == 0) {
+                hashes.push_back(bus.state_hash());
+                bus.save_state(*keyframes.emplace_back(std::make_unique<MachineState>()));
+            }
+            uint16 pads = movie_input(movie, frame);
+            bus.controller[0] = pads & 0xff;
+            bus.controller[1] = pads >> 8;
+            bus.execute_one_frame();
+        }
+        hashes.push_back(bus.state_hash());
+        uint64 visible_hash = visible_state_hash(bus);
+        double record_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        // a batch at a time, so an hour of movie doesn't need thousands of buses at once
+        ForkPool pool(threads);
+        size_t batch_size = 8 * pool.threads();
+        long mismatches = 0;
+        start = std::chrono::steady_clock::now();
+        for (long first = 0; first < segments; first += static_cast<long>(batch_size)) {
+            std::vector<std::unique_ptr<Bus>> buses;
+            std::vector<ForkPool::Job> jobs;
+            for (long segment = first; segment < std::min<long>(first + batch_size, segments); segment++) {
+                auto &fork = buses.emplace_back(bus.fork(*keyframes[segment]));
+                ForkPool::Job &job = jobs.emplace_back();
+                job.bus = fork.get();
+                for (long frame = segment * segment_frames; frame < std::min((segment + 1) * segment_frames, frames);
+                     frame++)
+                    job.input.push_back(movie_input(movie, frame));
+            }
+            pool.run(jobs);
+
+            for (size_t i = 0; i < jobs.size(); i++) {
+                long segment = first + static_cast<long>(i);
+                if (jobs[i].state_hash == hashes[segment + 1])
+                    continue;
+                if (mismatches++ == 0)
+                    fprintf(stderr, "frames %ld to %ld played back differently\n", segment * segment_frames,
+                            std::min((segment + 1) * segment_frames, frames));
+            }
+        }
+        double verify_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        printf("%ld frames recorded in %.3f s, %ld segments of %ld played back in %.3f s on %d threads: %s\n", frames,
+               record_seconds, segments, segment_frames, verify_seconds, pool.threads(),
+               mismatches == 0 ? "deterministic" : "NOT DETERMINISTIC");
+        if (mismatches > 0)
+            printf("%ld of %ld segments differ\n", mismatches, segments);
+        printf("state %016llx\n", (unsigned long long) visible_hash);
+        return mismatches == 0 ? 0 : 1;
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3)
+        usage();
+    const char *rom_path = argv[1];
+    const char *movie_path = argv[2];
+    const char *export_path = nullptr;
+    long frames = -1;
+    bool video = true;
+    int sample_rate = 0;
+    long boot_frames = 0;
+    const char *boot_cache_dir = ".";
+    double netplay_latency = -1;
+    bool store_states = false;
+    long verify_frames = 0;
+    int threads = 0;
+    for (int i = 3; i < argc; i++) {
+        std::string_view arg = argv[i];
+        if (arg == "--frames" && i + 1 < argc)
+            frames = std::strtol(argv[++i], nullptr, 10);
+        else if (arg == "--no-video")
+            video = false;
+        else if (arg == "--audio" && i + 1 < argc)
+            sample_rate = static_cast<int>(std::strtol(argv[++i], nullptr, 10));
+        else if (arg == "--export" && i + 1 < argc)
+            export_path = argv[++i];
+        else if (arg == "--boot" && i + 1 < argc)
+            boot_frames = std::strtol(argv[++i], nullptr, 10);
+        else if (arg == "--boot-cache" && i + 1 < argc)
+            boot_cache_dir = argv[++i];
+        else if (arg == "--netplay" && i + 1 < argc)
+            netplay_latency = std::strtod(argv[++i], nullptr);
+        else if (arg == "--store")
+            store_states = true;
+        else if (arg == "--verify" && i + 1 < argc)
+            verify_frames = std::strtol(argv[++i], nullptr, 10);
+        else if (arg == "--threads" && i + 1 < argc)
+            threads = static_cast<int>(std::strtol(argv[++i], nullptr, 10));
+        else
+            usage();
+    }
+
+    if (boot_frames < 0 || verify_frames < 0 || (boot_frames > 0 && netplay_latency >= 0)
+        || (verify_frames > 0 && (boot_frames > 0 || netplay_latency >= 0 || store_states)))
+        usage();
+
+    Bus bus(rom_path);
+    bus.reset();
+    bus.ppu.render_interval = video ? 1 : 0;
+    bus.apu.set_sample_rate(sample_rate);
+
+    Movie movie;
+    if (!(is_fm2(movie_path) ? movie::read_fm2(movie_path, movie) : movie::read(movie_path, movie)))
+        return 1;
+    if (movie.rom_hash != 0 && movie.rom_hash != bus.cartridge.rom_hash()) {
+        fprintf(stderr, "%s was recorded on another ROM\n", movie_path);
+        return 1;
+    }
+    if (export_path) {
+        movie.rom_hash = bus.cartridge.rom_hash();
+        if (!(is_fm2(export_path) ? movie::write_fm2(export_path, movie, rom_path) : movie::write(export_path, movie)))
+            return 1;
+    }
+    if (frames < 0)
+        frames = static_cast<long>(movie.input.size());
+    if (netplay_latency >= 0)
+        return run_netplay(rom_path, movie, frames, video, netplay_latency);
+    if (verify_frames > 0)
+        return run_verify(bus, movie, frames, verify_frames, threads);
+
+    for (long frame = 0; frame < boot_frames; frame++) {
+        if (movie_input(movie, frame) != 0) {
+            fprintf(stderr, "%s presses buttons on frame %ld, before --boot %ld\n", movie_path, frame, boot_frames);
+            return 1;
+        }
+    }
+    auto boot_start = std::chrono::steady_clock::now();
+    bool cached = boot_frames > 0 && boot_cache::boot(bus, boot_cache_dir, static_cast<int>(boot_frames));
+    double boot_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - boot_start).count();
+
+    StateStore store;
+    std::vector<uint64> stored_hashes;
+    auto stored = std::make_unique<MachineState>();
+    double store_seconds = 0;
+
+    int16 samples[4096];
+    auto start = std::chrono::steady_clock::now();
+    for (long frame = boot_frames; frame < frames; frame++) {
+        if (store_states) {
+            auto store_start = std::chrono::steady_clock::now();
+            bus.save_state(*stored);
+            StateStore::Id id = store.put(*stored);
+            ASSERT(id == stored_hashes.size(), "a store nothing was released from handed out id %u", id);
+            stored_hashes.push_back(fnv1a(stored.get(), sizeof(MachineState)));
+            store_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - store_start).count();
+        }
+        uint16 pads = movie_input(movie, frame);
+        bus.controller[0] = pads & 0xff;
+        bus.controller[1] = pads >> 8;
+        bus.execute_one_frame();
+        while (bus.apu.read_samples(samples, 4096) > 0) {}
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    uint64 state_hash = visible_state_hash(bus);
+
+    if (boot_frames > 0)
+        printf("booted to frame %ld in %.3f ms, %s\n", boot_frames, 1000 * boot_seconds,
+               cached ? "from the cache" : "and cached it");
+    long emulated = std::max(frames - boot_frames, 0L);
+    printf("%ld frames in %.3f s: %.1f fps, %.3f ms/frame\n", emulated, seconds, emulated / seconds,
+           1000 * seconds / std::max(emulated, 1L));
+    if (store_states) {
+        size_t mismatches = 0;
+        for (StateStore::Id id = 0; id < stored_hashes.size(); id++) {
+            store.get(id, *stored);
+            if (fnv1a(stored.get(), sizeof(MachineState)) != stored_hashes[id])
+                mismatches++;
+        }
+        auto stats = store.stats();
+        printf("stored %zu states of %zu bytes in %.3f ms: %zu pages of %zu, %.1f references each, %.2f MB resident "
+               "for %.2f MB of states (%.1fx), %zu came back different\n", stats.states, sizeof(MachineState),
+               1000 * store_seconds, stats.pages, StateStore::PAGE_SIZE, stats.dedup_ratio,
+               stats.resident_bytes / 1e6, stats.logical_bytes / 1e6,
+               static_cast<double>(stats.logical_bytes) / std::max<size_t>(stats.resident_bytes, 1), mismatches);
+        if (mismatches > 0)
+            return 1;
+    }
+    printf("state %016llx\n", (unsigned long long) state_hash);
+    if (bus.ppu.frame_buffer())
+        printf("picture %016llx\n", (unsigned long long) fnv1a(bus.ppu.frame_buffer(), SCREEN_WIDTH * SCREEN_HEIGHT));
+    return 0;
+}
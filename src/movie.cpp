@@ -0,0 +1,199 @@
+#include "movie.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+namespace {
+    // FM2 writes each controller as "RLDUTSBA", a letter for every button that's down and '.' otherwise; the
+    // letter at position i is bit i of the byte the NES reads out of the controller
+    constexpr char FM2_BUTTONS[] = "RLDUTSBA";
+
+    void put_fm2_pad(FILE *file, uint8 pad) {
+        for (int i = 0; i < 8; i++)
+            fputc(pad & (1 << i) ? FM2_BUTTONS[i] : '.', file);
+    }
+
+    /// Reads one controller's field, up to the next '|'. Any character other than '.' or a space is a button down.
+    uint8 get_fm2_pad(const char *&at) {
+        uint8 pad = 0;
+        for (int i = 0; *at && *at != '|'; i++, at++) {
+            if (i < 8 && *at != '.' && *at != ' ')
+                pad |= 1 << i;
+        }
+        if (*at == '|')
+            at++;
+        return pad;
+    }
+}
+
+bool movie::write(const char *path, const Movie &movie) {
+    std::vector<Run> runs;
+    for (uint16 input : movie.input) {
+        if (runs.empty() || runs.back().input != input || runs.back().frames == UINT16_MAX)
+            runs.push_back({input, 0});
+        runs.back().frames++;
+    }
+
+    FileHeader header = {};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.frames = static_cast<uint32>(movie.input.size());
+    header.runs = static_cast<uint32>(runs.size());
+    header.rom_hash = movie.rom_hash;
+
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        LOG_WARN("could not open %s for writing", path);
+        return false;
+    }
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1
+                   && fwrite(runs.data(), sizeof(Run), runs.size(), file) == runs.size();
+    written = fclose(file) == 0 && written;
+    if (!written)
+        LOG_WARN("could not write %s", path);
+    return written;
+}
+
+bool movie::read(const char *path, Movie &movie) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        LOG_WARN("could not open %s", path);
+        return false;
+    }
+    defer { fclose(file); };
+
+    FileHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0) {
+        LOG_WARN("%s is not a movie", path);
+        return false;
+    }
+    if (header.version != VERSION) {
+        LOG_WARN("%s is version %u, this build reads %u", path, header.version, VERSION);
+        return false;
+    }
+
+    // the counts are checked against the file before anything is allocated for them, so a corrupted header is
+    // refused rather than taken for gigabytes of input
+    long start = ftell(file);
+    if (start < 0 || fseek(file, 0, SEEK_END) != 0) {
+        LOG_WARN("could not read %s", path);
+        return false;
+    }
+    long end = ftell(file);
+    fseek(file, start, SEEK_SET);
+    if (end < start || static_cast<uint64>(header.runs) * sizeof(Run) != static_cast<uint64>(end - start)) {
+        LOG_WARN("%s is corrupted (%ld bytes of runs, the header says %u runs)", path, end - start, header.runs);
+        return false;
+    }
+
+    std::vector<Run> runs(header.runs);
+    if (fread(runs.data(), sizeof(Run), runs.size(), file) != runs.size()) {
+        LOG_WARN("%s is truncated", path);
+        return false;
+    }
+
+    uint64 frames = 0;
+    for (auto &run : runs)
+        frames += run.frames;
+    if (frames != header.frames) {
+        LOG_WARN("%s is corrupted (%llu frames, the header says %u)", path, (unsigned long long) frames,
+                 header.frames);
+        return false;
+    }
+
+    Movie loaded;
+    loaded.rom_hash = header.rom_hash;
+    loaded.input.reserve(header.frames);
+    for (auto &run : runs)
+        loaded.input.insert(loaded.input.end(), run.frames, run.input);
+    movie = std::move(loaded);
+    return true;
+}
+
+bool movie::write_fm2(const char *path, const Movie &movie, const char *rom_name) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        LOG_WARN("could not open %s for writing", path);
+        return false;
+    }
+
+    fprintf(file, "version 3\n");
+    fprintf(file, "emuVersion 22020\n");
+    fprintf(file, "rerecordCount 0\n");
+    fprintf(file, "palFlag 0\n");
+    fprintf(file, "romFilename %s\n", rom_name);
+    fprintf(file, "romChecksum base64:AAAAAAAAAAAAAAAAAAAAAA==\n");
+    fprintf(file, "guid 00000000-0000-0000-0000-000000000000\n");
+    fprintf(file, "fourscore 0\n");
+    fprintf(file, "microphone 0\n");
+    fprintf(file, "port0 1\n");
+    fprintf(file, "port1 1\n");
+    fprintf(file, "port2 0\n");
+    fprintf(file, "FDS 0\n");
+    fprintf(file, "NewPPU 0\n");
+    for (uint16 input : movie.input) {
+        fputs("|0|", file);
+        put_fm2_pad(file, input & 0xff);
+        fputc('|', file);
+        put_fm2_pad(file, input >> 8);
+        fputs("||\n", file);
+    }
+
+    bool written = !ferror(file);
+    written = fclose(file) == 0 && written;
+    if (!written)
+        LOG_WARN("could not write %s", path);
+    return written;
+}
+
+bool movie::read_fm2(const char *path, Movie &movie) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        LOG_WARN("could not open %s", path);
+        return false;
+    }
+    defer { fclose(file); };
+
+    Movie loaded;
+    bool gamepads = true;
+    uint64 commands = 0; // frames with a reset or some other command, which we can't play back
+    char line[1024];
+    while (fgets(line, sizeof(line), file)) {
+        if (line[0] != '|') {
+            // header lines are "key value"; only the controller types matter to us
+            int type;
+            if ((sscanf(line, "port0 %d", &type) == 1 || sscanf(line, "port1 %d", &type) == 1) && type > 1)
+                gamepads = false;
+            if (sscanf(line, "fourscore %d", &type) == 1 && type != 0)
+                gamepads = false;
+            continue;
+        }
+
+        // |commands|port0|port1|port2|
+        const char *at = line + 1;
+        if (std::strtol(at, nullptr, 10) != 0)
+            commands++;
+        at = std::strchr(at, '|');
+        if (!at) {
+            LOG_WARN("%s has a malformed input line %zu", path, loaded.input.size());
+            return false;
+        }
+        at++;
+        uint8 pad1 = get_fm2_pad(at);
+        uint8 pad2 = get_fm2_pad(at);
+        loaded.input.push_back(pad1 | pad2 << 8);
+
+        // a line too long for the buffer only had its port2 field cut, skip the rest of it
+        while (!std::strchr(line, '\n') && fgets(line, sizeof(line), file)) {}
+    }
+
+    if (!gamepads) {
+        LOG_WARN("%s uses controllers other than two standard ones", path);
+        return false;
+    }
+    if (commands > 0)
+        LOG_WARN("%s resets or sends other commands on %llu frames, ignoring them", path, (unsigned long long) commands);
+    movie = std::move(loaded);
+    return true;
+}
@@ -0,0 +1,281 @@
+#include "netplay.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "hash.h"
+
+namespace {
+    double wall_clock() {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+}
+
+uint64 state_checksum(const MachineState &state) {
+    return fnv1a(&state.cpu, sizeof(state.cpu), fnv1a(state.bus.ram.data(), state.bus.ram.size()));
+}
+
+UdpTransport::UdpTransport(uint16 local_port, const char *peer_host, uint16 peer_port) {
+    addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    addrinfo *peer;
+    std::string port = std::to_string(peer_port);
+    if (getaddrinfo(peer_host, port.c_str(), &hints, &peer) != 0) {
+        LOG_WARN("could not resolve %s", peer_host);
+        return;
+    }
+    defer { freeaddrinfo(peer); };
+
+    socket_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (socket_fd < 0) {
+        LOG_WARN("could not create a UDP socket");
+        return;
+    }
+
+    sockaddr_in local = {};
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    local.sin_port = htons(local_port);
+    // connected, so the socket only ever receives from the peer
+    if (bind(socket_fd, reinterpret_cast<sockaddr *>(&local), sizeof(local)) != 0
+        || connect(socket_fd, peer->ai_addr, peer->ai_addrlen) != 0
+        || fcntl(socket_fd, F_SETFL, fcntl(socket_fd, F_GETFL) | O_NONBLOCK) != 0) {
+        LOG_WARN("could not set up UDP port %u to talk to %s:%u", local_port, peer_host, peer_port);
+        close(socket_fd);
+        socket_fd = -1;
+    }
+}
+
+UdpTransport::~UdpTransport() {
+    if (socket_fd >= 0)
+        close(socket_fd);
+}
+
+void UdpTransport::send(const uint8 *data, size_t size) {
+    // a full socket buffer or a peer that isn't up yet is no different from a lost packet
+    ::send(socket_fd, data, size, 0);
+}
+
+size_t UdpTransport::receive(uint8 *data, size_t capacity) {
+    for (;;) {
+        ssize_t size = recv(socket_fd, data, capacity, 0);
+        if (size > 0)
+            return size;
+        // ECONNREFUSED just means the peer wasn't listening yet when we last sent to it
+        if (size < 0 && errno == ECONNREFUSED)
+            continue;
+        return 0;
+    }
+}
+
+LoopbackLink::LoopbackLink(double latency, double jitter, double loss, uint32 seed)
+        : latency(latency), jitter(jitter), loss(loss), random(seed), endpoints{{*this, 0}, {*this, 1}},
+          clock(wall_clock) {}
+
+void LoopbackLink::Endpoint::send(const uint8 *data, size_t size) {
+    std::uniform_real_distribution<double> uniform(0, 1);
+    if (uniform(link.random) < link.loss)
+        return;
+
+    double arrival = link.clock() + link.latency + uniform(link.random) * link.jitter;
+    auto &queue = link.in_flight[1 - side];
+    auto at = std::find_if(queue.begin(), queue.end(), [&](const Packet &p) { return p.arrival > arrival; });
+    queue.insert(at, {arrival, std::vector<uint8>(data, data + size)});
+}
+
+size_t LoopbackLink::Endpoint::receive(uint8 *data, size_t capacity) {
+    auto &queue = link.in_flight[side];
+    if (queue.empty() || queue.front().arrival > link.clock())
+        return 0;
+
+    size_t size = std::min(capacity, queue.front().data.size());
+    std::memcpy(data, queue.front().data.data(), size);
+    queue.pop_front();
+    return size;
+}
+
+Rollback::Rollback(Bus &bus, Transport &transport, int player, int input_delay)
+        : bus(bus), transport(transport), player(player), input_delay(input_delay),
+          rom_hash(bus.cartridge.rom_hash()), states(MAX_PREDICTION + 2), clock(wall_clock) {
+    ASSERT(player == 0 || player == 1, "player %d", player);
+    ASSERT(input_delay >= 0 && input_delay < MAX_PACKET_INPUTS / 2, "input delay %d", input_delay);
+    local_count = input_delay; // nothing is pressed before the first delayed input comes due
+}
+
+bool Rollback::advance(uint8 input) {
+    receive();
+    if (rollback_to < current_frame)
+        roll_back();
+    rollback_to = UINT32_MAX;
+
+    // predicting too far ahead makes rollbacks long, and the peer may just be gone
+    bool wait = current_frame >= remote_count + MAX_PREDICTION;
+
+    // both sides see the other as behind by the latency, the difference between what they see is what's real
+    int32 advantage = static_cast<int32>(current_frame - peer_frame);
+    if (++frames_since_wait >= TIME_SYNC_INTERVAL && advantage - peer_advantage >= 2) {
+        frames_since_wait = 0;
+        wait = true;
+    }
+    if (wait) {
+        stats.waits++;
+        send();
+        return false;
+    }
+
+    local_inputs[local_count++ % HISTORY] = input;
+    run_frame();
+    stats.frames++;
+    record_checksum();
+    send();
+    return true;
+}
+
+void Rollback::poll() {
+    receive();
+    send();
+}
+
+std::optional<uint64> Rollback::confirmed_checksum(uint32 frame) const {
+    auto &checksum = checksums[frame % HISTORY];
+    if (checksum.frame != frame)
+        return {};
+    return checksum.value;
+}
+
+void Rollback::receive() {
+    Packet packet;
+    size_t size;
+    while ((size = transport.receive(reinterpret_cast<uint8 *>(&packet), sizeof(packet))) > 0) {
+        if (size < offsetof(Packet, inputs) || packet.magic != MAGIC || packet.input_count > MAX_PACKET_INPUTS
+            || size < offsetof(Packet, inputs) + packet.input_count)
+            continue;
+        if (packet.rom_hash != rom_hash) {
+            if (!warned_rom)
+                LOG_WARN("the peer is running another ROM");
+            warned_rom = true;
+            continue;
+        }
+
+        peer_ack = std::max(peer_ack, packet.ack);
+        if (packet.frame >= peer_frame) {
+            peer_frame = packet.frame;
+            peer_advantage = packet.advantage;
+            echo_ms = packet.time_ms;
+        }
+        if (packet.echo_ms != NO_ECHO) {
+            double ping = static_cast<uint32>(now_ms() - packet.echo_ms);
+            stats.ping_ms = stats.ping_ms == 0 ? ping : stats.ping_ms + (ping - stats.ping_ms) * 0.1;
+        }
+
+        // only ever appended in order, inputs we already have or can't place yet are just dropped
+        for (uint32 i = 0; i < packet.input_count; i++) {
+            uint32 frame = packet.first_input + i;
+            if (frame != remote_count)
+                continue;
+            remote_inputs[frame % HISTORY] = packet.inputs[i];
+            if (frame < current_frame && predicted[frame % HISTORY] != packet.inputs[i])
+                rollback_to = std::min(rollback_to, frame);
+            remote_count++;
+        }
+
+        if (packet.checksum_frame != UINT32_MAX) {
+            peer_checksums[packet.checksum_frame % HISTORY] = {packet.checksum_frame, packet.checksum};
+            compare_checksum(packet.checksum_frame);
+        }
+    }
+}
+
+void Rollback::send() {
+    Packet packet;
+    packet.magic = MAGIC;
+    packet.frame = current_frame;
+    packet.advantage = static_cast<int32>(current_frame - peer_frame);
+    packet.ack = remote_count;
+    packet.first_input = peer_ack;
+    packet.input_count = std::min<uint32>(local_count - peer_ack, MAX_PACKET_INPUTS);
+    for (uint32 i = 0; i < packet.input_count; i++)
+        packet.inputs[i] = local_inputs[(peer_ack + i) % HISTORY];
+    packet.checksum_frame = latest_checksum.frame;
+    packet.checksum = latest_checksum.value;
+    packet.time_ms = now_ms();
+    packet.echo_ms = echo_ms;
+    packet.rom_hash = rom_hash;
+    transport.send(reinterpret_cast<const uint8 *>(&packet), offsetof(Packet, inputs) + packet.input_count);
+}
+
+void Rollback::roll_back() {
+    uint32 present = current_frame;
+    int depth = static_cast<int>(present - rollback_to);
+    ASSERT(depth < static_cast<int>(states.size()), "rollback of %d frames is past the saved states", depth);
+    stats.rollbacks++;
+    stats.resimulated_frames += depth;
+    stats.max_depth = std::max<uint64>(stats.max_depth, depth);
+
+    {
+        ReplaySettings settings(bus);
+        bus.load_state(state_at(rollback_to));
+        for (current_frame = rollback_to; current_frame < present;)
+            run_frame();
+    }
+    // the frame coming up was decided not to be drawn while the one before it was being run again
+    if (bus.ppu.render_interval > 0)
+        bus.ppu.draw_next_frame();
+}
+
+void Rollback::run_frame() {
+    uint32 frame = current_frame;
+    bus.save_state(state_at(frame));
+
+    uint8 remote = remote_input(frame);
+    predicted[frame % HISTORY] = remote;
+    bus.controller[player] = local_inputs[frame % HISTORY];
+    bus.controller[1 - player] = remote;
+    bus.execute_one_frame();
+    current_frame++;
+}
+
+uint8 Rollback::remote_input(uint32 frame) const {
+    if (frame < remote_count)
+        return remote_inputs[frame % HISTORY];
+    // players mostly hold buttons for many frames, so the last known input is the best guess
+    return remote_count > 0 ? remote_inputs[(remote_count - 1) % HISTORY] : 0;
+}
+
+void Rollback::record_checksum() {
+    // states can't change anymore once every input before them is in, and they're only kept for a few frames
+    uint32 newest = std::min(remote_count, current_frame - 1);
+    uint32 oldest = current_frame >= states.size() ? current_frame - states.size() + 1 : 0;
+    for (uint32 frame = std::max(next_checksum, oldest); frame <= newest && current_frame > 0; frame++) {
+        checksums[frame % HISTORY] = {frame, state_checksum(state_at(frame))};
+        latest_checksum = checksums[frame % HISTORY];
+        compare_checksum(frame);
+        next_checksum = frame + 1;
+    }
+}
+
+void Rollback::compare_checksum(uint32 frame) {
+    auto &ours = checksums[frame % HISTORY], &theirs = peer_checksums[frame % HISTORY];
+    if (ours.frame != frame || theirs.frame != frame || ours.value == theirs.value)
+        return;
+
+    stats.desyncs++;
+    if (!warned_desync)
+        LOG_WARN("desynced from the peer at frame %u", frame);
+    warned_desync = true;
+    theirs.frame = UINT32_MAX; // counted once
+}
+
+uint32 Rollback::now_ms() const {
+    return static_cast<uint32>(static_cast<uint64>(clock() * 1000));
+}
@@ -0,0 +1,22 @@
+#include "palette.h"
+
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+std::optional<Palette> load_palette(const char *path) {
+    std::ifstream f(path, std::ios::binary);
+    if (!f.is_open())
+        return std::nullopt;
+
+    std::vector<uint8> data((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+    if (data.size() != 64 * 3 && data.size() != 512 * 3) {
+        LOG_WARN("'%s' is not a palette: expected 192 or 1536 bytes, got %zu", path, data.size());
+        return std::nullopt;
+    }
+
+    Palette palette;
+    for (size_t i = 0; i < palette.size(); i++)
+        palette[i] = {data[i * 3], data[i * 3 + 1], data[i * 3 + 2]};
+    return palette;
+}
@@ -0,0 +1,25 @@
+#include "panel.h"
+
+#include "gfx.h"
+
+Panel::Panel(SDL_Renderer *renderer, const Font &font, SDL_Rect rect) : font(font), rect(rect) {
+    surface = gfx::create_surface(rect.w, rect.h);
+    texture = gfx::create_texture(renderer, rect.w, rect.h);
+}
+
+Panel::~Panel() {
+    SDL_DestroyTexture(texture);
+    SDL_FreeSurface(surface);
+}
+
+void Panel::text(int x, int y, std::string_view text, SDL_Color color) {
+    font.render_to_surface(surface, x - rect.x, y - rect.y, text, color);
+}
+
+void Panel::present(SDL_Renderer *renderer) {
+    if (dirty) {
+        gfx::upload(texture, surface);
+        dirty = false;
+    }
+    SDL_RenderCopy(renderer, texture, nullptr, &rect);
+}
@@ -1,16 +1,96 @@
 #include <ppu.h>
-#include <gfx.h>
-#include "bus.h"
 
-extern SDL_Color palette_array[64];
+#include <cstring>
+
+#include "bus.h"
+#include "render_thread.h"
+
+namespace {
+    uint8 flip_byte(uint8 b) {
+        b = (b & 0xf0) >> 4 | (b & 0x0f) << 4;
+        b = (b & 0xcc) >> 2 | (b & 0x33) << 2;
+        b = (b & 0xaa) >> 1 | (b & 0x55) << 1;
+        return b;
+    }
+}
 
 PPU::PPU(Bus &bus, Cartridge *cartridge) : bus(bus), cartridge(cartridge) {
-    screen = gfx::create_surface(256, 240);
-    pattern_tables[0] = gfx::create_surface(128, 128);
-    pattern_tables[1] = gfx::create_surface(128, 128);
-    for (int i = 0; i < 8; i++)
-        palettes[i] = gfx::create_surface(16, 4);
-    ASSERT(screen, "failed to create surface");
+    update_mirroring();
+}
+
+void PPU::set_frame_buffer(uint8 *buffer) {
+    own_frame.reset();
+    frame = buffer;
+    if (!frame)
+        ensure_frame_buffer();
+}
+
+void PPU::ensure_frame_buffer() {
+    if (frame)
+        return;
+
+    own_frame = std::make_unique<uint8[]>(SCREEN_WIDTH * SCREEN_HEIGHT);
+    frame = own_frame.get();
+}
+
+void PPU::copy_state(const PPU &other) {
+    load_state(other);
+    frame_writes = other.frame_writes;
+
+    // whatever part of the current frame is already drawn
+    if (other.frame) {
+        ensure_frame_buffer();
+        std::memcpy(frame, other.frame, SCREEN_WIDTH * SCREEN_HEIGHT);
+    }
+}
+
+void PPU::load_state(const PPUState &state) {
+    PPUState::operator=(state);
+
+    // the page table points into our own nametables, so it's rebuilt rather than copied
+    ASSERT(cartridge->mirroring == current_mirroring, "cartridges disagree on the mirroring");
+    map_name_tables();
+    // the state may be from the middle of a frame being drawn, on a PPU that never drew one before
+    if (frame_path != RenderPath::Timing)
+        ensure_frame_buffer();
+}
+
+void PPU::record_event(PPUEvent::Kind kind, uint16 addr, uint8 data) {
+    if (render_thread)
+        render_thread->record({dots, addr, data, kind});
+}
+
+void PPU::update_mirroring() {
+    catch_up();
+    current_mirroring = cartridge->mirroring;
+    map_name_tables();
+}
+
+void PPU::map_name_tables() {
+    int pages[4];
+    switch (current_mirroring) {
+
+    case Mirroring::Horizontal:
+        pages[0] = 0; pages[1] = 0; pages[2] = 1; pages[3] = 1;
+        break;
+    case Mirroring::Vertical:
+        pages[0] = 0; pages[1] = 1; pages[2] = 0; pages[3] = 1;
+        break;
+    case Mirroring::SingleScreenLower:
+        pages[0] = 0; pages[1] = 0; pages[2] = 0; pages[3] = 0;
+        break;
+    case Mirroring::SingleScreenUpper:
+        pages[0] = 1; pages[1] = 1; pages[2] = 1; pages[3] = 1;
+        break;
+    case Mirroring::FourScreen:
+        pages[0] = 0; pages[1] = 1; pages[2] = 2; pages[3] = 3;
+        break;
+    default:
+        UNREACHABLE("unknown mirroring %d", static_cast<int>(current_mirroring));
+    }
+
+    for (int i = 0; i < 4; i++)
+        name_table_pages[i] = name_table_mem[pages[i]];
 }
 
 uint8 *PPU::ppu_locate(uint16 addr) {
@@ -18,33 +98,8 @@ uint8 *PPU::ppu_locate(uint16 addr) {
         LOG_WARN("ppu address %04x should have mapped by the cartridge", addr);
         return nullptr;
     } else if (addr >= NAMETABLE_START && addr <= NAMETABLE_END) {
-        addr &= 0xfff;
-        switch (cartridge->mirroring) {
-
-        case Mirroring::Vertical:
-            if (addr >= 0 && addr <= 0x3ff)
-                return &name_table_mem[0][addr & 0x3ff];
-            else if (addr >= 0x400 && addr <= 0x7ff)
-                return &name_table_mem[1][addr & 0x3ff];
-            else if (addr >= 0x800 && addr <= 0xbff)
-                return &name_table_mem[0][addr & 0x3ff];
-            else if (addr >= 0xc00 && addr <= 0xfff)
-                return &name_table_mem[1][addr & 0x3ff];
-            else
-                UNREACHABLE("ranges above covers all addresses");
-
-        case Mirroring::Horizontal:
-            if (addr >= 0 && addr <= 0x3ff)
-                return &name_table_mem[0][addr & 0x3ff];
-            else if (addr >= 0x400 && addr <= 0x7ff)
-                return &name_table_mem[0][addr & 0x3ff];
-            else if (addr >= 0x800 && addr <= 0xbff)
-                return &name_table_mem[1][addr & 0x3ff];
-            else if (addr >= 0xc00 && addr <= 0xfff)
-                return &name_table_mem[1][addr & 0x3ff];
-            else
-                UNREACHABLE("ranges above covers all addresses");
-        }
+        // $3000-$3EFF mirrors $2000-$2EFF, so bits 10-11 always select one of the four logical nametables
+        return &name_table_pages[(addr >> 10) & 3][addr & 0x3ff];
     } else if (addr >= PALETTE_START && addr <= PALETTE_END) {
         addr &= 0x1f;
         if (addr == 0x10) addr = 0x0;
@@ -58,8 +113,8 @@ uint8 *PPU::ppu_locate(uint16 addr) {
 }
 
 void PPU::ppu_write(uint16 addr, uint8 data) {
-    if (bus.breakpoints_enabled && std::find(address_write_breakpoints.begin(), address_write_breakpoints.end(), addr) != address_write_breakpoints.end()) {
-        throw BreakpointException{};
+    if (!replica && bus.breakpoints_enabled && std::find(address_write_breakpoints.begin(), address_write_breakpoints.end(), addr) != address_write_breakpoints.end()) {
+        bus.hit_breakpoint();
     }
 
     if (cartridge->ppu_write(addr, data)) {
@@ -72,8 +127,8 @@ void PPU::ppu_write(uint16 addr, uint8 data) {
 }
 
 uint8 PPU::ppu_read(uint16 addr) {
-    if (bus.breakpoints_enabled && std::find(address_read_breakpoints.begin(), address_read_breakpoints.end(), addr) != address_read_breakpoints.end()) {
-        throw BreakpointException{};
+    if (!replica && bus.breakpoints_enabled && std::find(address_read_breakpoints.begin(), address_read_breakpoints.end(), addr) != address_read_breakpoints.end()) {
+        bus.hit_breakpoint();
     }
 
     if (auto data = cartridge->ppu_read(addr); data.has_value()) {
@@ -87,11 +142,29 @@ uint8 PPU::ppu_read(uint16 addr) {
     }
 }
 
+
+uint8 PPU::render_read(uint16 addr) {
+    addr &= 0x3fff;
+    if (addr <= PATTERN_END)
+        return cartridge->ppu_read(addr).value_or(0);
+    else if (addr <= NAMETABLE_END)
+        return name_table_pages[(addr >> 10) & 3][addr & 0x3ff];
+    else
+        return *ppu_locate(addr);
+}
+
 void PPU::cpu_write(uint16 addr, uint8 data) {
+    // writes while the PPU is drawing are logged so the renderer knows whether it can draw the frame in bulk
+    bool mid_frame = scanline >= -1 && scanline < 240;
+    if (mid_frame)
+        log_frame_write(addr, data);
+
     switch (addr) {
 
     case 0:
         control.value = data;
+        tram_addr.nametable_x = control.base_nametable_addr & 1;
+        tram_addr.nametable_y = control.base_nametable_addr >> 1;
         break;
     case 1:
         mask.value = data;
@@ -99,18 +172,32 @@ void PPU::cpu_write(uint16 addr, uint8 data) {
     case 2:
         break;
     case 3:
+        oam_addr = data;
         break;
     case 4:
+        oam_mem[oam_addr++] = data;
         break;
+
     case 5:
+        // https://www.nesdev.org/wiki/PPU_scrolling#Register_controls
+        if (!next_address_is_lsb) {
+            fine_x = data & 0x7;
+            tram_addr.coarse_x = data >> 3;
+            next_address_is_lsb = true;
+        } else {
+            tram_addr.fine_y = data & 0x7;
+            tram_addr.coarse_y = data >> 3;
+            next_address_is_lsb = false;
+        }
         break;
 
     case 6:
         if (next_address_is_lsb) {
-            vram_addr.value = (vram_addr.value & 0xFF00) | data;
+            tram_addr.value = (tram_addr.value & 0xFF00) | data;
+            vram_addr = tram_addr;
             next_address_is_lsb = false;
         } else {
-            vram_addr.value = (vram_addr.value & 0xFF) | (data << 8);
+            tram_addr.value = (tram_addr.value & 0xFF) | ((data & 0x3F) << 8);
             next_address_is_lsb = true;
         }
         break;
@@ -124,6 +211,20 @@ void PPU::cpu_write(uint16 addr, uint8 data) {
         break;
 
     }
+
+    // logged once the write has gone through, a breakpoint means the CPU will make it again
+    record_event(PPUEvent::RegisterWrite, addr, data);
+
+    if (mid_frame && frame_path != RenderPath::Precise && rendering_enabled()) {
+        // a PPUADDR write during hblank moves where the next scanline's tiles are prefetched from
+        if (addr == 6 && !next_address_is_lsb && scanline < 239 && cycle >= 257 && cycle < 321)
+            line_start_addr[scanline + 1] = vram_addr;
+
+        if (cycle >= 257)
+            predict_sprite_zero_hit(scanline + 1, 0);
+        else
+            predict_sprite_zero_hit(scanline, std::max(cycle - 1, 0));
+    }
 }
 
 uint8 PPU::cpu_read(uint16 addr) {
@@ -137,12 +238,13 @@ uint8 PPU::cpu_read(uint16 addr) {
         uint8 ret = (status.value & 0xe0) | (internal_read_buffer & 0x1f);
         status.vertical_blank = 0;
         next_address_is_lsb = false;
+        record_event(PPUEvent::RegisterRead, addr, 0);
         return ret;
     }
     case 3:
         break;
     case 4:
-        break;
+        return oam_mem[oam_addr];
     case 5:
         break;
 
@@ -150,6 +252,14 @@ uint8 PPU::cpu_read(uint16 addr) {
         break;
 
     case 7: {
+        if (scanline >= -1 && scanline < 240 && rendering_enabled()) {
+            // moves the address the pipeline is fetching from, which only the dot-level path can follow
+            catch_up();
+            frame_has_complex_write = true;
+            if (frame_path != RenderPath::Precise)
+                fallback_pending = true;
+        }
+
         // all reads except the palette memory are delayed by one frame
         uint8 data = internal_read_buffer;
         internal_read_buffer = ppu_read(vram_addr.value);
@@ -157,6 +267,7 @@ uint8 PPU::cpu_read(uint16 addr) {
             data = internal_read_buffer;
 
         vram_addr.value += (control.vram_addr_increment ? 32 : 1);
+        record_event(PPUEvent::RegisterRead, addr, 0);
         return data;
     }
 
@@ -168,62 +279,581 @@ uint8 PPU::cpu_read(uint16 addr) {
     return 0;
 }
 
-SDL_Surface *PPU::render_screen() {
-    return screen;
+// https://www.nesdev.org/wiki/PPU_scrolling#Wrapping_around
+
+void PPU::increment_scroll_x() {
+    if (!rendering_enabled())
+        return;
+
+    if (vram_addr.coarse_x == 31) {
+        vram_addr.coarse_x = 0;
+        vram_addr.nametable_x ^= 1;
+    } else {
+        vram_addr.coarse_x++;
+    }
+}
+
+void PPU::increment_scroll_y() {
+    if (!rendering_enabled())
+        return;
+
+    if (vram_addr.fine_y < 7) {
+        vram_addr.fine_y++;
+    } else {
+        vram_addr.fine_y = 0;
+        if (vram_addr.coarse_y == 29) {
+            vram_addr.coarse_y = 0;
+            vram_addr.nametable_y ^= 1;
+        } else if (vram_addr.coarse_y == 31) {
+            // attribute memory, wraps without switching nametables
+            vram_addr.coarse_y = 0;
+        } else {
+            vram_addr.coarse_y++;
+        }
+    }
+}
+
+void PPU::transfer_address_x() {
+    if (!rendering_enabled())
+        return;
+
+    vram_addr.nametable_x = tram_addr.nametable_x;
+    vram_addr.coarse_x = tram_addr.coarse_x;
+}
+
+void PPU::transfer_address_y() {
+    if (!rendering_enabled())
+        return;
+
+    vram_addr.fine_y = tram_addr.fine_y;
+    vram_addr.nametable_y = tram_addr.nametable_y;
+    vram_addr.coarse_y = tram_addr.coarse_y;
+}
+
+int PPU::select_sprites(int line, ObjectAttribute out[8], bool &includes_sprite_zero, bool &overflow) const {
+    // https://www.nesdev.org/wiki/PPU_sprite_evaluation
+    // sprites are drawn one scanline below their y coordinate, so these are the sprites visible on line + 1
+    int height = control.sprite_size ? 16 : 8;
+    int count = 0;
+    includes_sprite_zero = false;
+    overflow = false;
+
+    for (int i = 0; i < 64; i++) {
+        int diff = line - oam_mem[i * 4];
+        if (diff < 0 || diff >= height)
+            continue;
+
+        if (count == 8) {
+            overflow = true;
+            break;
+        }
+
+        if (i == 0)
+            includes_sprite_zero = true;
+        out[count++] = {oam_mem[i * 4], oam_mem[i * 4 + 1], oam_mem[i * 4 + 2], oam_mem[i * 4 + 3]};
+    }
+
+    return count;
+}
+
+void PPU::fetch_sprite_row(const ObjectAttribute &sprite, int line, uint8 &lsb, uint8 &msb) {
+    int row = line - sprite.y;
+    bool flip_vertical = sprite.attribute & 0x80;
+    uint16 addr;
+
+    if (!control.sprite_size) {
+        if (flip_vertical)
+            row = 7 - row;
+        addr = (control.sprite_pattern_addr << 12) | (sprite.id << 4) | row;
+    } else {
+        // 8x16 sprites take their pattern table from bit 0 of the tile id, and use two consecutive tiles
+        if (flip_vertical)
+            row = 15 - row;
+        addr = ((sprite.id & 1) << 12) | ((sprite.id & 0xfe) << 4) | ((row & 8) << 1) | (row & 7);
+    }
+
+    lsb = render_read(addr);
+    msb = render_read(addr + 8);
+
+    if (sprite.attribute & 0x40) {
+        lsb = flip_byte(lsb);
+        msb = flip_byte(msb);
+    }
+}
+
+void PPU::fetch_background_tile(render_register addr, int tile, uint8 &lsb, uint8 &msb, uint8 &palette) {
+    int coarse_x = addr.coarse_x + tile;
+    int nametable_x = addr.nametable_x ^ ((coarse_x >> 5) & 1);
+    coarse_x &= 31;
+
+    uint16 nametable = (addr.nametable_y << 11) | (nametable_x << 10);
+    uint8 id = render_read(0x2000 | nametable | (addr.coarse_y << 5) | coarse_x);
+    uint8 attrib = render_read(0x23c0 | nametable | ((addr.coarse_y >> 2) << 3) | (coarse_x >> 2));
+    if (addr.coarse_y & 2) attrib >>= 4;
+    if (coarse_x & 2) attrib >>= 2;
+    palette = attrib & 3;
+
+    uint16 pattern = (control.background_pattern_addr << 12) + (id << 4) + addr.fine_y;
+    lsb = render_read(pattern);
+    msb = render_read(pattern + 8);
 }
 
-SDL_Surface *PPU::render_pattern_table(int table, uint8 palette) {
-    SDL_Surface *surface = pattern_tables[table];
-    SDL_LockSurface(surface);
+uint8 PPU::compose_pixel(int x, uint8 bg_pixel, uint8 bg_palette, uint8 fg_pixel, uint8 fg_palette,
+                         bool fg_in_front, bool fg_is_sprite_zero, bool &sprite_zero_hit) const {
+    // https://www.nesdev.org/wiki/PPU_rendering#Preface
+    sprite_zero_hit = false;
+
+    if (bg_pixel == 0 && fg_pixel == 0)
+        return 0;
+    if (bg_pixel == 0)
+        return (fg_palette << 2) | fg_pixel;
+    if (fg_pixel == 0)
+        return (bg_palette << 2) | bg_pixel;
+
+    // both pixels are opaque; the hardware never reports a hit on the last column
+    sprite_zero_hit = fg_is_sprite_zero && x != 255;
+    if (fg_in_front)
+        return (fg_palette << 2) | fg_pixel;
+    else
+        return (bg_palette << 2) | bg_pixel;
+}
 
-    for (int y = 0; y < 16; y++) {
-        for (int x = 0; x < 16; x++) {
-            int tile_index = y * 16 + x;
+void PPU::put_pixel(int x, int y, uint8 palette_index) {
+    frame[y * SCREEN_WIDTH + x] = palette_mem[palette_index] & (mask.grayscale ? 0x30 : 0x3f);
+}
 
-            for (int row = 0; row < 8; row++) {
-                uint8 tile_lsb = ppu_read(table * 0x1000 + tile_index * 16 + row);
-                uint8 tile_msb = ppu_read(table * 0x1000 + tile_index * 16 + row + 8);
+void PPU::load_background_shifters() {
+    bg_shifter_pattern_lo = (bg_shifter_pattern_lo & 0xff00) | bg_next_tile_lsb;
+    bg_shifter_pattern_hi = (bg_shifter_pattern_hi & 0xff00) | bg_next_tile_msb;
+    bg_shifter_attrib_lo = (bg_shifter_attrib_lo & 0xff00) | ((bg_next_tile_attrib & 1) ? 0xff : 0x00);
+    bg_shifter_attrib_hi = (bg_shifter_attrib_hi & 0xff00) | ((bg_next_tile_attrib & 2) ? 0xff : 0x00);
+}
 
-                for (int col = 0; col < 8; col++) {
-                    int shift = 7-col;
-                    int bit = 1 << shift; // most-significant bit is left-most pixel
-                    uint8 pixel = ((tile_lsb & bit) >> shift) + ((tile_msb & bit) >> shift);
+void PPU::update_shifters() {
+    if (mask.show_background) {
+        bg_shifter_pattern_lo <<= 1;
+        bg_shifter_pattern_hi <<= 1;
+        bg_shifter_attrib_lo <<= 1;
+        bg_shifter_attrib_hi <<= 1;
+    }
 
-                    int pixel_x = x * 8 + col;
-                    int pixel_y = y * 8 + row;
-                    auto color = color_from_palette(palette, pixel);
-                    gfx::set_pixel(surface, pixel_x, pixel_y, color);
-                }
+    if (mask.show_sprites && cycle >= 1 && cycle < 258) {
+        for (int i = 0; i < sprite_count; i++) {
+            if (sprite_scanline[i].x > 0) {
+                sprite_scanline[i].x--;
+            } else {
+                sprite_shifter_pattern_lo[i] <<= 1;
+                sprite_shifter_pattern_hi[i] <<= 1;
             }
         }
     }
+}
+
+void PPU::clock_pipeline() {
+    // https://www.nesdev.org/w/images/default/4/4f/Ppu.svg
+    if ((cycle >= 2 && cycle < 258) || (cycle >= 321 && cycle < 338)) {
+        update_shifters();
+
+        switch ((cycle - 1) % 8) {
+
+        case 0:
+            load_background_shifters();
+            bg_next_tile_id = render_read(0x2000 | (vram_addr.value & 0x0fff));
+            break;
+        case 2:
+            bg_next_tile_attrib = render_read(0x23c0 | (vram_addr.nametable_y << 11) | (vram_addr.nametable_x << 10)
+                                              | ((vram_addr.coarse_y >> 2) << 3) | (vram_addr.coarse_x >> 2));
+            if (vram_addr.coarse_y & 2) bg_next_tile_attrib >>= 4;
+            if (vram_addr.coarse_x & 2) bg_next_tile_attrib >>= 2;
+            bg_next_tile_attrib &= 3;
+            break;
+        case 4:
+            bg_next_tile_lsb = render_read((control.background_pattern_addr << 12) + (bg_next_tile_id << 4)
+                                           + vram_addr.fine_y);
+            break;
+        case 6:
+            bg_next_tile_msb = render_read((control.background_pattern_addr << 12) + (bg_next_tile_id << 4)
+                                           + vram_addr.fine_y + 8);
+            break;
+        case 7:
+            increment_scroll_x();
+            break;
+
+        }
+    }
+
+    if (cycle == 256) {
+        increment_scroll_y();
+    } else if (cycle == 257) {
+        load_background_shifters();
+        transfer_address_x();
+
+        if (scanline >= 0 && rendering_enabled()) {
+            bool overflow;
+            sprite_count = select_sprites(scanline, sprite_scanline, sprite_zero_possible, overflow);
+            if (overflow)
+                status.sprite_overflow = 1;
+        } else {
+            sprite_count = 0;
+        }
+    } else if (cycle == 338 || cycle == 340) {
+        bg_next_tile_id = render_read(0x2000 | (vram_addr.value & 0x0fff));
+    }
+
+    if (scanline == -1 && cycle >= 280 && cycle < 305)
+        transfer_address_y();
 
-    SDL_UnlockSurface(surface);
-    return surface;
+    if (cycle == 340) {
+        for (int i = 0; i < sprite_count; i++)
+            fetch_sprite_row(sprite_scanline[i], scanline, sprite_shifter_pattern_lo[i], sprite_shifter_pattern_hi[i]);
+    }
+}
+
+void PPU::draw_pipeline_pixel() {
+    int x = cycle - 1;
+
+    uint8 bg_pixel = 0, bg_palette = 0;
+    if (mask.show_background && (mask.show_background_left || x >= 8)) {
+        uint16 bit = 0x8000 >> fine_x;
+        bg_pixel = ((bg_shifter_pattern_hi & bit) ? 2 : 0) | ((bg_shifter_pattern_lo & bit) ? 1 : 0);
+        bg_palette = ((bg_shifter_attrib_hi & bit) ? 2 : 0) | ((bg_shifter_attrib_lo & bit) ? 1 : 0);
+    }
+
+    uint8 fg_pixel = 0, fg_palette = 0;
+    bool fg_in_front = false, fg_is_sprite_zero = false;
+    if (mask.show_sprites && (mask.show_sprites_left || x >= 8)) {
+        for (int i = 0; i < sprite_count; i++) {
+            if (sprite_scanline[i].x != 0)
+                continue;
+
+            fg_pixel = ((sprite_shifter_pattern_hi[i] & 0x80) ? 2 : 0) | ((sprite_shifter_pattern_lo[i] & 0x80) ? 1 : 0);
+            if (fg_pixel != 0) {
+                // sprites earlier in OAM have priority, so the first opaque one wins
+                fg_palette = (sprite_scanline[i].attribute & 3) + 4;
+                fg_in_front = !(sprite_scanline[i].attribute & 0x20);
+                fg_is_sprite_zero = i == 0 && sprite_zero_possible;
+                break;
+            }
+        }
+    }
+
+    bool sprite_zero_hit;
+    uint8 index = compose_pixel(x, bg_pixel, bg_palette, fg_pixel, fg_palette, fg_in_front, fg_is_sprite_zero,
+                                sprite_zero_hit);
+    if (sprite_zero_hit)
+        status.sprite_zero_hit = 1;
+    // a frame that isn't drawn still falls back to the pipeline for its sprite 0 timing
+    if (frame_started_on != RenderPath::Timing)
+        put_pixel(x, scanline, index);
+}
+
+void PPU::clock_timing() {
+    // only the parts of the pipeline the CPU can observe: scrolling, sprite evaluation and sprite 0 hits
+    if (!rendering_enabled())
+        return;
+
+    if (scanline == sprite_zero_hit_line && cycle == sprite_zero_hit_cycle)
+        status.sprite_zero_hit = 1;
+
+    switch (cycle) {
+
+    case 256:
+        increment_scroll_y();
+        break;
+
+    case 257:
+        transfer_address_x();
+        if (scanline >= 0) {
+            bool overflow;
+            sprite_count = select_sprites(scanline, sprite_scanline, sprite_zero_possible, overflow);
+            if (overflow)
+                status.sprite_overflow = 1;
+            if (scanline < 239) {
+                line_start_addr[scanline + 1] = vram_addr;
+                predict_sprite_zero_hit(scanline + 1, 0);
+            }
+        } else {
+            sprite_count = 0;
+        }
+        break;
+
+    case 304:
+        if (scanline == -1) {
+            transfer_address_y();
+            line_start_addr[0] = vram_addr;
+        }
+        break;
+
+    case 336:
+        // the two tiles prefetched for the next scanline
+        increment_scroll_x();
+        increment_scroll_x();
+        break;
+
+    default:
+        break;
+
+    }
 }
 
-SDL_Surface *PPU::render_palette(int palette) {
-    auto surface = palettes[palette];
-    SDL_LockSurface(surface);
-    for (int y = 0; y < 4; y++) {
-        for (int x = 0; x < 16; x++) {
-            int color_index = x / 4;
-            auto color = color_from_palette((uint8) palette, (uint8) color_index);
-            gfx::set_pixel(surface, x, y, color);
+void PPU::build_sprite_line(int line) {
+    sprite_line = line;
+    std::fill(std::begin(sprite_line_pixels), std::end(sprite_line_pixels), 0);
+    if (line == 0)
+        return;
+
+    ObjectAttribute sprites[8];
+    bool includes_sprite_zero, overflow;
+    int count = select_sprites(line - 1, sprites, includes_sprite_zero, overflow);
+
+    for (int i = 0; i < count; i++) {
+        uint8 lsb, msb;
+        fetch_sprite_row(sprites[i], line - 1, lsb, msb);
+
+        uint8 attributes = ((sprites[i].attribute & 3) << 2)
+                           | (!(sprites[i].attribute & 0x20) << 4)
+                           | ((i == 0 && includes_sprite_zero) << 5);
+        for (int col = 0; col < 8 && sprites[i].x + col < 256; col++) {
+            uint8 &out = sprite_line_pixels[sprites[i].x + col];
+            uint8 pixel = (((msb >> (7 - col)) & 1) << 1) | ((lsb >> (7 - col)) & 1);
+            if ((out & 3) == 0 && pixel != 0)
+                out = pixel | attributes;
+        }
+    }
+}
+
+void PPU::render_span(int line, int x0, int x1) {
+    if (!rendering_enabled()) {
+        for (int x = x0; x < x1; x++)
+            put_pixel(x, line, 0);
+        return;
+    }
+
+    if (sprite_line != line)
+        build_sprite_line(line);
+
+    render_register addr = line_start_addr[line];
+    bool show_sprites = mask.show_sprites;
+    int x = x0;
+    while (x < x1) {
+        // the pipeline's shifters are fine_x pixels into the first tile, so that is where column 0 comes from
+        int column = fine_x + x;
+        uint8 lsb, msb, palette;
+        fetch_background_tile(addr, column >> 3, lsb, msb, palette);
+
+        int tile_end = std::min(x1, x + 8 - (column & 7));
+        for (; x < tile_end; x++) {
+            uint8 bg_pixel = 0;
+            if (mask.show_background && (mask.show_background_left || x >= 8)) {
+                int shift = 7 - ((fine_x + x) & 7);
+                bg_pixel = (((msb >> shift) & 1) << 1) | ((lsb >> shift) & 1);
+            }
+
+            uint8 fg = 0;
+            if (show_sprites && (mask.show_sprites_left || x >= 8))
+                fg = sprite_line_pixels[x];
+
+            bool sprite_zero_hit; // already predicted on the emulation side
+            uint8 index = compose_pixel(x, bg_pixel, palette, fg & 3, ((fg >> 2) & 3) + 4, fg & 0x10, fg & 0x20,
+                                        sprite_zero_hit);
+            put_pixel(x, line, index);
         }
     }
-    SDL_UnlockSurface(surface);
-    return surface;
 }
 
-SDL_Color PPU::color_from_palette(uint8 palette, uint8 pixel) {
-    uint8 index = ppu_read(0x3f00 + (palette << 2) + pixel);
-    return palette_array[index % 64];
+void PPU::catch_up() {
+    if (frame_path != RenderPath::Fast || scanline < 0)
+        return;
+
+    // cycle has already moved past the last dot processed, so pixels [0, cycle - 1) are out on this scanline
+    int target_line = std::min(scanline, 240);
+    int target_x = scanline >= 240 ? 0 : std::clamp(cycle - 1, 0, 256);
+
+    while (rendered_line < target_line) {
+        render_span(rendered_line, rendered_x, 256);
+        rendered_line++;
+        rendered_x = 0;
+    }
+
+    if (rendered_line < 240 && target_x > rendered_x) {
+        render_span(rendered_line, rendered_x, target_x);
+        rendered_x = target_x;
+    }
+}
+
+void PPU::predict_sprite_zero_hit(int line, int first_x) {
+    sprite_zero_hit_line = -1;
+    sprite_zero_hit_cycle = -1;
+
+    if (status.sprite_zero_hit || line <= 0 || line >= 240 || !mask.show_background || !mask.show_sprites)
+        return;
+
+    ObjectAttribute sprite = {oam_mem[0], oam_mem[1], oam_mem[2], oam_mem[3]};
+    int row = line - 1 - sprite.y;
+    if (row < 0 || row >= (control.sprite_size ? 16 : 8))
+        return;
+
+    uint8 sprite_lsb, sprite_msb;
+    fetch_sprite_row(sprite, line - 1, sprite_lsb, sprite_msb);
+
+    render_register addr = line_start_addr[line];
+    bool clip_left = !mask.show_background_left || !mask.show_sprites_left;
+    int fetched_tile = -1;
+    uint8 lsb = 0, msb = 0, palette;
+
+    for (int col = 0; col < 8; col++) {
+        int x = sprite.x + col;
+        if (x >= 255)
+            break;
+        if (x < first_x || (clip_left && x < 8))
+            continue;
+        if (!(((sprite_lsb | sprite_msb) >> (7 - col)) & 1))
+            continue;
+
+        int column = fine_x + x;
+        if ((column >> 3) != fetched_tile) {
+            fetched_tile = column >> 3;
+            fetch_background_tile(addr, fetched_tile, lsb, msb, palette);
+        }
+
+        if (((lsb | msb) >> (7 - (column & 7))) & 1) {
+            // the dot-level path raises the flag on the dot that outputs pixel x
+            sprite_zero_hit_line = line;
+            sprite_zero_hit_cycle = x + 1;
+            return;
+        }
+    }
+}
+
+void PPU::log_frame_write(uint8 reg, uint8 data) {
+    if (reg == 2 || reg == 3)
+        return;
+
+    // everything already drawn has to see the registers and memory as they were before this write
+    catch_up();
+
+    bool enables_rendering = !rendering_enabled() && reg == 1 && (data & 0x18);
+    if (!rendering_enabled() && !enables_rendering)
+        return;
+
+    bool simple;
+    switch (reg) {
+
+    case 0:
+        // only the nametable select (part of the scroll) may change, not the pattern tables or sprite size
+        simple = ((control.value ^ data) & 0x38) == 0;
+        break;
+    case 1:
+        // turning rendering on after the pre-render line has set up the scroll can't be replayed in bulk
+        simple = !enables_rendering || (scanline == -1 && cycle < 256);
+        break;
+    case 5:
+        simple = true;
+        break;
+    case 6:
+        // the second write copies t into v, which is only safe before the next scanline's prefetch starts
+        simple = !next_address_is_lsb || (scanline < 239 && cycle >= 257 && cycle < 321);
+        break;
+    default:
+        // OAM and VRAM accesses while rendering
+        simple = false;
+        break;
+
+    }
+
+    frame_writes.push_back({static_cast<int16>(scanline), static_cast<int16>(cycle), reg, data, simple});
+    if (!simple) {
+        // even a frame that isn't drawn switches over, since the sprite 0 hit timing depends on it
+        frame_has_complex_write = true;
+        if (frame_path != RenderPath::Precise)
+            fallback_pending = true;
+    }
+}
+
+void PPU::begin_frame() {
+    bool draw = !render_thread && render_interval > 0 && frame_number % render_interval == 0;
+    frame_number++;
+
+    frame_path = draw ? next_frame_path : RenderPath::Timing;
+    if (draw)
+        ensure_frame_buffer();
+    frame_started_on = frame_path;
+    fallback_pending = false;
+    frame_has_complex_write = false;
+    frame_writes.clear();
+
+    rendered_line = 0;
+    rendered_x = 0;
+    sprite_line = -1;
+    sprite_zero_hit_line = -1;
+    sprite_zero_hit_cycle = -1;
+}
+
+void PPU::draw_next_frame() {
+    if (scanline != -1 || cycle != 0 || frame_path != RenderPath::Timing)
+        return;
+    frame_path = frame_started_on = next_frame_path;
+    ensure_frame_buffer();
+}
+
+void PPU::finish_frame() {
+    catch_up();
+
+    // a frame that isn't drawn may still have fallen back to the pipeline for its sprite 0 timing
+    if (frame_started_on == RenderPath::Timing)
+        render_stats.skipped_frames++;
+    else if (frame_started_on == RenderPath::Precise)
+        render_stats.precise_frames++;
+    else if (frame_path == RenderPath::Precise)
+        render_stats.fallback_frames++;
+    else
+        render_stats.fast_frames++;
+
+    // games that do raster effects usually do them every frame, so stay on the dot-level path while they do
+    next_frame_path = (force_precise || frame_has_complex_write) ? RenderPath::Precise : RenderPath::Fast;
+}
+
+void PPU::clock_mapper_scanline() {
+    if (!rendering_enabled())
+        return;
+
+    // A12 rises when the PPU moves from fetching the $0000 pattern table to the $1000 one. With the usual setup
+    // (background at $0000, sprites at $1000) that's the sprite fetches at dot 260, with the opposite setup it's
+    // the background prefetch at dot 324.
+    bool sprites_high = control.sprite_size || control.sprite_pattern_addr;
+    bool background_high = control.background_pattern_addr;
+    if ((cycle == 260 && sprites_high && !background_high) || (cycle == 324 && background_high && !sprites_high))
+        cartridge->clock_scanline();
 }
 
 void PPU::clock(bool &nmi_requested) {
-    if (scanline == -1 && cycle == 1) {
-        status.vertical_blank = 0;
+    if (scanline >= -1 && scanline < 240) {
+        if (scanline == -1 && cycle == 1) {
+            status.vertical_blank = 0;
+            status.sprite_zero_hit = 0;
+            status.sprite_overflow = 0;
+            std::fill(std::begin(sprite_shifter_pattern_lo), std::end(sprite_shifter_pattern_lo), 0);
+            std::fill(std::begin(sprite_shifter_pattern_hi), std::end(sprite_shifter_pattern_hi), 0);
+        }
+
+        if (frame_path != RenderPath::Precise && fallback_pending && cycle == 321) {
+            // draw everything up to here in bulk, then let the pipeline prefetch the next scanline itself
+            catch_up();
+            frame_path = RenderPath::Precise;
+        }
+
+        if (frame_path == RenderPath::Precise)
+            clock_pipeline();
+        else
+            clock_timing();
+
+        if (cycle == 260 || cycle == 324)
+            clock_mapper_scanline();
+
+        if (frame_path == RenderPath::Precise && scanline >= 0 && cycle >= 1 && cycle <= 256)
+            draw_pipeline_pixel();
+    } else if (scanline == 240 && cycle == 0) {
+        finish_frame();
     } else if (scanline == 241 && cycle == 1) {
         status.vertical_blank = 1;
         if (control.nmi_on_vblank) {
@@ -232,79 +862,15 @@ void PPU::clock(bool &nmi_requested) {
     }
 
     cycle++;
+    dots++;
     if (cycle >= 341) {
         cycle = 0;
         scanline++;
         if (scanline >= 261) {
             scanline = -1;
             finished_frame = true;
+            record_event(PPUEvent::FrameEnd, 0, 0);
+            begin_frame();
         }
     }
 }
-
-SDL_Color palette_array[64] = {
-        {117, 117, 117},
-        {39,  27, 143},
-        {0,   0, 171},
-        {71,   0, 159},
-        {143,   0, 119},
-        {171,   0,  19},
-        {167,   0,   0},
-        {127,  11,   0},
-        {67,  47,   0},
-        {0,  71,   0},
-        {0,  81,   0},
-        {0,  63,  23},
-        {27,  63,  95},
-        {0,   0,   0},
-        {0,   0,   0},
-        {0,   0,   0},
-        {188, 188, 188},
-        {0, 115, 239},
-        {35,  59, 239},
-        {131,   0, 243},
-        {191,   0, 191},
-        {231,   0,  91},
-        {219,  43,   0},
-        {203,  79,  15},
-        {139, 115,   0},
-        {0, 151,   0},
-        {0, 171,   0},
-        {0, 147,  59},
-        {0, 131, 139},
-        {0,   0,   0},
-        {0,   0,   0},
-        {0,   0,   0},
-        {255, 255, 255},
-        {63, 191, 255},
-        {95, 151, 255},
-        {167, 139, 253},
-        {247, 123, 255},
-        {255, 119, 183},
-        {255, 119,  99},
-        {255, 155,  59},
-        {243, 191,  63},
-        {131, 211,  19},
-        {79, 223,  75},
-        {88, 248, 152},
-        {0, 235, 219},
-        {0,   0,   0},
-        {0,   0,   0},
-        {0,   0,   0},
-        {255, 255, 255},
-        {171, 231, 255},
-        {199, 215, 255},
-        {215, 203, 255},
-        {255, 199, 255},
-        {255, 199, 219},
-        {255, 191, 179},
-        {255, 219, 171},
-        {255, 231, 163},
-        {227, 255, 163},
-        {171, 243, 191},
-        {179, 255, 207},
-        {159, 255, 243},
-        {0,   0,   0},
-        {0,   0,   0},
-        {0,   0,   0}
-};
\ No newline at end of file
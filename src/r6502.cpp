@@ -74,7 +74,7 @@ void R6502::clock(Bus &bus) {
 void R6502::reset(Bus &bus) noexcept {
     a = x = y = 0;
     sp = 0xFD;
-    status = U;
+    status = U | I;
 
     uint16 lo = read(bus, 0xFFFC);
     uint16 hi = read(bus, 0xFFFD);
@@ -84,7 +84,7 @@ void R6502::reset(Bus &bus) noexcept {
 }
 
 void R6502::irq(Bus &bus) noexcept {
-    if (status & I) {
+    if (!(status & I)) {
         do_interrupt(bus, 0xFFFE);
         cycles = 7;
     }
@@ -99,9 +99,9 @@ void R6502::do_interrupt(Bus &bus, uint16 vector) {
     write(bus, 0x100 + sp--, pc >> 8);
     write(bus, 0x100 + sp--, pc & 0xFF);
 
-    status &= ~B;
-    status |= (U | I);
-    write(bus, 0x100 + sp--, status);
+    // the status goes on the stack as it was before the interrupt, so RTI unmasks IRQs again
+    write(bus, 0x100 + sp--, (status | U) & ~B);
+    status |= I;
 
     uint16 lo = read(bus, vector);
     uint16 hi = read(bus, vector + 1);
@@ -578,14 +578,14 @@ uint8 R6502::do_addition(uint8 src_reg, uint8 operand) {
 
 uint8 R6502::read(Bus &bus, uint16 addr) {
     if (bus.breakpoints_enabled && std::find(address_read_breakpoints.begin(), address_read_breakpoints.end(), addr) != address_read_breakpoints.end()) {
-        throw BreakpointException{};
+        bus.hit_breakpoint();
     }
     return bus.read(addr);
 }
 
 void R6502::write(Bus &bus, uint16 addr, uint8 data) {
     if (bus.breakpoints_enabled && std::find(address_write_breakpoints.begin(), address_write_breakpoints.end(), addr) != address_write_breakpoints.end()) {
-        throw BreakpointException{};
+        bus.hit_breakpoint();
     }
     bus.write(addr, data);
 }
@@ -0,0 +1,121 @@
+#include "render_thread.h"
+
+#include <chrono>
+#include <cstring>
+
+RenderThread::RenderThread(Bus &bus)
+    : bus(bus)
+    , cartridge(bus.cartridge.clone())
+    , ppu(bus, &cartridge)
+    , log(LOG_CAPACITY)
+    , frame(SCREEN_WIDTH * SCREEN_HEIGHT)
+{
+    copy_bus_state();
+    ppu.replica = true;
+
+    if (auto pixels = bus.ppu.frame_buffer())
+        std::memcpy(frame.data(), pixels, frame.size());
+
+    bus.ppu.render_thread = this;
+    worker = std::thread([this] { run(); });
+}
+
+RenderThread::~RenderThread() {
+    bus.ppu.render_thread = nullptr;
+    running = false;
+    worker.join();
+}
+
+void RenderThread::record(const PPUEvent &event) {
+    while (!log.push(event))
+        std::this_thread::yield();
+}
+
+void RenderThread::resync() {
+    resyncing.store(true, std::memory_order_relaxed);
+    // at dot 0, so the worker's PPU isn't clocked towards wherever the bus's is now
+    record({0, 0, 0, PPUEvent::Resync});
+    // the bus stays put meanwhile, so the worker can read it
+    while (resyncing.load(std::memory_order_acquire))
+        std::this_thread::yield();
+}
+
+void RenderThread::copy_bus_state() {
+    uint8 mapper_state[Mapper::STATE_SIZE] = {};
+    bus.cartridge.save_state(mapper_state);
+    cartridge.load_state(mapper_state);
+    cartridge.mirroring = bus.cartridge.mirroring;
+    ppu.copy_state(bus.ppu);
+}
+
+void RenderThread::run() {
+    int idle_polls = 0;
+    PPUEvent event;
+
+    while (running.load(std::memory_order_relaxed)) {
+        if (!log.pop(event)) {
+            // the log fills steadily while a game runs, so only sleep once it has been empty for a while
+            if (++idle_polls < 64)
+                std::this_thread::yield();
+            else
+                std::this_thread::sleep_for(std::chrono::microseconds(500));
+            continue;
+        }
+
+        idle_polls = 0;
+        apply(event);
+    }
+}
+
+void RenderThread::apply(const PPUEvent &event) {
+    // the CPU only raises NMIs from the bus's PPU
+    bool nmi_requested = false;
+    while (ppu.dots < event.dot)
+        ppu.clock(nmi_requested);
+
+    switch (event.kind) {
+
+    case PPUEvent::RegisterWrite:
+        ppu.cpu_write(event.addr, event.data);
+        break;
+    case PPUEvent::RegisterRead:
+        ppu.cpu_read(event.addr);
+        break;
+    case PPUEvent::CartridgeWrite:
+        if (cartridge.cpu_write(event.addr, event.data) && cartridge.mirroring != ppu.mirroring())
+            ppu.update_mirroring();
+        break;
+    case PPUEvent::FrameEnd:
+        publish_frame();
+        break;
+    case PPUEvent::Resync:
+        copy_bus_state();
+        resyncing.store(false, std::memory_order_release);
+        break;
+    default:
+        UNREACHABLE("unknown event kind %d", event.kind);
+
+    }
+}
+
+void RenderThread::publish_frame() {
+    std::lock_guard lock(frame_mutex);
+    if (auto pixels = ppu.frame_buffer())
+        std::memcpy(frame.data(), pixels, frame.size());
+    frame_stats = ppu.render_stats;
+    frames_rendered++;
+}
+
+const uint8 *RenderThread::acquire_frame() {
+    frame_mutex.lock();
+    return frame.data();
+}
+
+void RenderThread::release_frame() {
+    frame_mutex.unlock();
+}
+
+RenderStats RenderThread::stats() {
+    std::lock_guard lock(frame_mutex);
+    return frame_stats;
+}
@@ -0,0 +1,188 @@
+#include "rewind.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+    // a coded state is a sequence of (zero count, literal count, literal bytes), with both counts as LEB128 varints;
+    // with a base, the bytes coded are the XOR against it, so unchanged bytes become runs of zeros
+
+    void put_varint(std::vector<uint8> &out, size_t value) {
+        while (value >= 0x80) {
+            out.push_back(static_cast<uint8>(value | 0x80));
+            value >>= 7;
+        }
+        out.push_back(static_cast<uint8>(value));
+    }
+
+    size_t get_varint(const uint8 *&in) {
+        size_t value = 0;
+        for (int shift = 0;; shift += 7) {
+            uint8 byte = *in++;
+            value |= static_cast<size_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+                return value;
+        }
+    }
+
+    /// @param base nullptr to code `data` as is
+    void encode(const uint8 *data, const uint8 *base, size_t size, std::vector<uint8> &out) {
+        auto at = [&](size_t i) -> uint8 { return base ? data[i] ^ base[i] : data[i]; };
+
+        out.clear();
+        size_t i = 0;
+        while (i < size) {
+            size_t zeros_start = i;
+            while (i < size && at(i) == 0)
+                i++;
+
+            // a single zero costs less as a literal than as the end of one literal run and the start of another
+            size_t literals_start = i;
+            while (i < size && (at(i) != 0 || (i + 1 < size && at(i + 1) != 0)))
+                i++;
+
+            put_varint(out, literals_start - zeros_start);
+            put_varint(out, i - literals_start);
+            for (size_t j = literals_start; j < i; j++)
+                out.push_back(at(j));
+        }
+    }
+
+    /// @param base the one `data` was coded against, or nullptr
+    void decode(const std::vector<uint8> &data, const uint8 *base, uint8 *out, size_t size) {
+        const uint8 *in = data.data(), *end = in + data.size();
+        size_t i = 0;
+        while (in < end) {
+            size_t zeros = get_varint(in);
+            size_t literals = get_varint(in);
+            ASSERT(i + zeros + literals <= size, "coded state overruns %zu bytes", size);
+
+            if (base)
+                std::memcpy(out + i, base + i, zeros);
+            else
+                std::memset(out + i, 0, zeros);
+            i += zeros;
+            for (size_t j = 0; j < literals; j++, i++)
+                out[i] = base ? in[j] ^ base[i] : in[j];
+            in += literals;
+        }
+        ASSERT(i == size, "coded state is %zu bytes short", size - i);
+    }
+}
+
+Rewind::Rewind(size_t budget, int keyframe_interval, bool threaded)
+        : budget(budget), keyframe_interval(keyframe_interval), ring(RING_CAPACITY),
+          keyframe(std::make_unique<MachineState>()), scratch(std::make_unique<MachineState>()),
+          decoded_keyframe(std::make_unique<MachineState>()) {
+    ASSERT(keyframe_interval > 0, "keyframe interval %d", keyframe_interval);
+    if (threaded)
+        worker = std::thread(&Rewind::run, this);
+}
+
+Rewind::~Rewind() {
+    running.store(false, std::memory_order_release);
+    if (worker.joinable())
+        worker.join();
+}
+
+void Rewind::push(const MachineState &state) {
+    if (!worker.joinable()) {
+        std::lock_guard guard(lock);
+        store(state);
+        return;
+    }
+    if (!ring.push(state))
+        dropped++;
+}
+
+bool Rewind::pop(MachineState &state) {
+    std::lock_guard guard(lock);
+    drain();
+    if (history.empty())
+        return false;
+
+    // deltas only refer back to the keyframe they follow
+    auto entry = history.end() - 1;
+    auto key = entry;
+    while (!key->keyframe)
+        --key;
+    if (key->frame != decoded_frame) {
+        decode(key->data, nullptr, reinterpret_cast<uint8 *>(decoded_keyframe.get()), sizeof(MachineState));
+        decoded_frame = key->frame;
+    }
+
+    if (entry->keyframe) {
+        state = *decoded_keyframe;
+        has_keyframe = false; // the next push has to start a new one
+    } else {
+        decode(entry->data, reinterpret_cast<const uint8 *>(decoded_keyframe.get()),
+               reinterpret_cast<uint8 *>(&state), sizeof(MachineState));
+    }
+
+    history_bytes -= sizeof(Entry) + entry->data.size();
+    history.pop_back();
+    update_stats();
+    return true;
+}
+
+void Rewind::clear() {
+    std::lock_guard guard(lock);
+    drain();
+    history.clear();
+    history_bytes = 0;
+    has_keyframe = false;
+    decoded_frame = UINT64_MAX;
+    update_stats();
+}
+
+void Rewind::run() {
+    while (running.load(std::memory_order_acquire)) {
+        {
+            std::lock_guard guard(lock);
+            drain();
+        }
+        std::this_thread::sleep_for(WAKE_INTERVAL);
+    }
+}
+
+void Rewind::drain() {
+    while (ring.pop(*scratch))
+        store(*scratch);
+}
+
+void Rewind::store(const MachineState &state) {
+    auto bytes = reinterpret_cast<const uint8 *>(&state);
+    bool is_keyframe = !has_keyframe || frames_since_keyframe >= keyframe_interval;
+    if (is_keyframe) {
+        encode(bytes, nullptr, sizeof(MachineState), encoded);
+        *keyframe = state;
+        has_keyframe = true;
+        frames_since_keyframe = 0;
+    } else {
+        encode(bytes, reinterpret_cast<const uint8 *>(keyframe.get()), sizeof(MachineState), encoded);
+    }
+    frames_since_keyframe++;
+
+    // copied out rather than moved, so the entry takes only what it needs and `encoded` keeps its capacity
+    history.push_back({next_frame++, is_keyframe, std::vector<uint8>(encoded.begin(), encoded.end())});
+    history_bytes += sizeof(Entry) + encoded.size();
+    evict();
+    update_stats();
+}
+
+void Rewind::evict() {
+    while (history_bytes > budget) {
+        // a keyframe can only go together with its deltas, and the newest one never goes
+        auto next_keyframe = std::find_if(history.begin() + 1, history.end(), [](const Entry &e) { return e.keyframe; });
+        if (next_keyframe == history.end())
+            return;
+        for (auto e = history.begin(); e != next_keyframe; ++e)
+            history_bytes -= sizeof(Entry) + e->data.size();
+        history.erase(history.begin(), next_keyframe);
+    }
+}
+
+void Rewind::update_stats() {
+    stats_frames.store(history.size(), std::memory_order_relaxed);
+    stats_bytes.store(history_bytes, std::memory_order_relaxed);
+}
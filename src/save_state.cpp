@@ -0,0 +1,67 @@
+#include "save_state.h"
+
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+
+#include "hash.h"
+
+bool save_state::write(const char *path, const MachineState &state, uint64 rom_hash) {
+    FileHeader header = {};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = MachineState::VERSION;
+    header.state_size = sizeof(MachineState);
+    header.rom_hash = rom_hash;
+    header.state_hash = fnv1a(&state, sizeof(state));
+
+    // written next to the old file first, so a failed save never destroys the previous one
+    std::string temp_path = std::string(path) + ".tmp";
+    FILE *file = fopen(temp_path.c_str(), "wb");
+    if (!file) {
+        LOG_WARN("could not open %s for writing", temp_path.c_str());
+        return false;
+    }
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(&state, sizeof(state), 1, file) == 1;
+    written = fclose(file) == 0 && written;
+
+    if (!written || std::rename(temp_path.c_str(), path) != 0) {
+        LOG_WARN("could not write %s", path);
+        std::remove(temp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool save_state::read(const char *path, MachineState &state, uint64 rom_hash) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        LOG_WARN("could not open %s", path);
+        return false;
+    }
+    defer { fclose(file); };
+
+    FileHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0) {
+        LOG_WARN("%s is not a save state", path);
+        return false;
+    }
+    if (header.version != MachineState::VERSION || header.state_size != sizeof(MachineState)) {
+        LOG_WARN("%s is from another version (%u, %u bytes), this one is %u, %zu bytes", path, header.version,
+                 header.state_size, MachineState::VERSION, sizeof(MachineState));
+        return false;
+    }
+    if (header.rom_hash != rom_hash) {
+        LOG_WARN("%s was saved from another ROM", path);
+        return false;
+    }
+
+    // read aside, so a bad file leaves `state` as it was
+    auto loaded = std::make_unique<MachineState>();
+    if (fread(loaded.get(), sizeof(MachineState), 1, file) != 1 || fnv1a(loaded.get(), sizeof(MachineState)) != header.state_hash) {
+        LOG_WARN("%s is truncated or corrupted", path);
+        return false;
+    }
+    std::memcpy(&state, loaded.get(), sizeof(MachineState));
+    return true;
+}
@@ -0,0 +1,142 @@
+#include "state_store.h"
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+
+#include "hash.h"
+
+StateStore::StateStore() {
+    // the regions' edges are found on a state rather than with offsetof, which the PPU's private members rule out
+    auto state = std::make_unique<MachineState>();
+    auto offset = [&](const void *member) {
+        return static_cast<uint32>(static_cast<const uint8 *>(member) - reinterpret_cast<const uint8 *>(state.get()));
+    };
+    const uint32 edges[] = {
+        offset(state->bus.ram.data()), offset(state->bus.ram.data() + state->bus.ram.size()),
+        offset(state->ppu.name_table_mem), offset(state->ppu.name_table_mem + 4),
+        offset(state->ppu.palette_mem), offset(state->ppu.oam_mem + sizeof(state->ppu.oam_mem)),
+        sizeof(MachineState),
+    };
+
+    uint32 start = 0;
+    for (uint32 edge : edges) {
+        ASSERT(edge >= start, "the regions are out of order");
+        for (; start < edge; start += spans.back().size)
+            spans.push_back({start, std::min<uint32>(PAGE_SIZE, edge - start)});
+    }
+}
+
+StateStore::Id StateStore::put(const MachineState &state) {
+    Id id;
+    if (!free_states.empty()) {
+        id = free_states.back();
+        free_states.pop_back();
+    } else {
+        ASSERT(tables.size() / spans.size() < NO_PAGE, "too many states");
+        id = static_cast<Id>(tables.size() / spans.size());
+        tables.resize(tables.size() + spans.size());
+    }
+
+    auto bytes = reinterpret_cast<const uint8 *>(&state);
+    uint32 *numbers = table(id);
+    for (size_t i = 0; i < spans.size(); i++) {
+        if (spans[i].size == PAGE_SIZE) {
+            numbers[i] = intern(bytes + spans[i].offset);
+        } else {
+            uint8 page[PAGE_SIZE] = {};
+            std::memcpy(page, bytes + spans[i].offset, spans[i].size);
+            numbers[i] = intern(page);
+        }
+    }
+    live_states++;
+    page_references += spans.size();
+    return id;
+}
+
+void StateStore::get(Id id, MachineState &state) const {
+    ASSERT(id < tables.size() / spans.size() && table(id)[0] != NO_PAGE, "no state %u", id);
+    auto bytes = reinterpret_cast<uint8 *>(&state);
+    const uint32 *numbers = table(id);
+    for (size_t i = 0; i < spans.size(); i++)
+        std::memcpy(bytes + spans[i].offset, pages[numbers[i]].data.data(), spans[i].size);
+}
+
+void StateStore::release(Id id) {
+    ASSERT(id < tables.size() / spans.size() && table(id)[0] != NO_PAGE, "no state %u", id);
+    uint32 *numbers = table(id);
+    for (size_t i = 0; i < spans.size(); i++)
+        release_page(numbers[i]);
+    numbers[0] = NO_PAGE;
+    free_states.push_back(id);
+    live_states--;
+    page_references -= spans.size();
+}
+
+void StateStore::clear() {
+    pages.clear();
+    free_pages.clear();
+    index.clear();
+    tables.clear();
+    free_states.clear();
+    live_states = 0;
+    page_references = 0;
+}
+
+uint32 StateStore::intern(const uint8 *data) {
+    uint64 hash = fnv1a(data, PAGE_SIZE);
+    auto [first, last] = index.equal_range(hash);
+    for (auto it = first; it != last; ++it) {
+        Page &page = pages[it->second];
+        if (std::memcmp(page.data.data(), data, PAGE_SIZE) == 0) {
+            page.references++;
+            return it->second;
+        }
+    }
+
+    uint32 number;
+    if (!free_pages.empty()) {
+        number = free_pages.back();
+        free_pages.pop_back();
+    } else {
+        ASSERT(pages.size() < NO_PAGE, "too many pages");
+        number = static_cast<uint32>(pages.size());
+        pages.emplace_back();
+    }
+    Page &page = pages[number];
+    page.hash = hash;
+    page.references = 1;
+    std::memcpy(page.data.data(), data, PAGE_SIZE);
+    index.emplace(hash, number);
+    return number;
+}
+
+void StateStore::release_page(uint32 number) {
+    Page &page = pages[number];
+    if (--page.references > 0)
+        return;
+
+    auto [first, last] = index.equal_range(page.hash);
+    for (auto it = first; it != last; ++it) {
+        if (it->second == number) {
+            index.erase(it);
+            break;
+        }
+    }
+    free_pages.push_back(number);
+}
+
+StateStore::Stats StateStore::stats() const {
+    Stats stats;
+    stats.states = live_states;
+    stats.pages = pages.size() - free_pages.size();
+    stats.logical_bytes = live_states * sizeof(MachineState);
+    // the index's nodes are a key, a value and the link between them, give or take the allocator's overhead
+    size_t index_bytes = index.bucket_count() * sizeof(void *)
+                         + index.size() * (sizeof(std::pair<const uint64, uint32>) + sizeof(void *));
+    stats.resident_bytes = pages.capacity() * sizeof(Page) + free_pages.capacity() * sizeof(uint32)
+                           + tables.capacity() * sizeof(uint32) + free_states.capacity() * sizeof(Id)
+                           + index_bytes;
+    stats.dedup_ratio = stats.pages > 0 ? static_cast<double>(page_references) / stats.pages : 0;
+    return stats;
+}
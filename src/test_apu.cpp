@@ -0,0 +1,73 @@
+#include <algorithm>
+#include <vector>
+
+#include <catch2/catch_all.hpp>
+
+#include "hash.h"
+#include "test_program.h"
+
+namespace {
+    struct AudioRun {
+        uint64 samples_hash = fnv1a(nullptr, 0);
+        size_t samples = 0;
+        bool audible = false;
+        std::vector<uint8> irqs; // the program's IRQ count after every frame
+        uint64 state_hash = 0;
+    };
+
+    AudioRun run_test_program(bool reference, int sample_rate, int frames) {
+        auto bus = test_bus();
+        bus->apu.set_sample_rate(sample_rate);
+        bus->apu.set_reference_mode(reference);
+
+        AudioRun run;
+        int16 samples[1024];
+        for (int frame = 0; frame < frames; frame++) {
+            run_test_frame(*bus, frame);
+            // read every frame, so the lazy APU is caught up at all sorts of points in its channels' periods
+            int count;
+            while ((count = bus->apu.read_samples(samples, 1024)) > 0) {
+                run.samples_hash = fnv1a(samples, count * sizeof(int16), run.samples_hash);
+                run.samples += count;
+                run.audible = run.audible || std::any_of(samples, samples + count, [](int16 s) { return s != 0; });
+            }
+            run.irqs.push_back(bus->ram[0x13]);
+        }
+        // the frame counter's IRQs are handled, acknowledged by reading $4015
+        REQUIRE(run.irqs.back() != run.irqs.front());
+        run.state_hash = bus->state_hash();
+        return run;
+    }
+}
+
+TEST_CASE("catching the APU up lazily is identical to stepping it every cycle", "[apu]") {
+    SECTION("with audio") {
+        AudioRun lazy = run_test_program(false, 44100, 600);
+        AudioRun reference = run_test_program(true, 44100, 600);
+        REQUIRE(lazy.audible);
+        REQUIRE(lazy.samples == reference.samples);
+        REQUIRE(lazy.samples_hash == reference.samples_hash);
+        REQUIRE(lazy.irqs == reference.irqs);
+        REQUIRE(lazy.state_hash == reference.state_hash);
+    }
+
+    SECTION("without audio") {
+        // nothing is mixed, so only IRQs, DMC fetches and register reads make it catch up
+        AudioRun lazy = run_test_program(false, 0, 600);
+        AudioRun reference = run_test_program(true, 0, 600);
+        REQUIRE(lazy.irqs == reference.irqs);
+        REQUIRE(lazy.state_hash == reference.state_hash);
+    }
+}
+
+TEST_CASE("the frame counter's IRQ reaches the CPU", "[apu]") {
+    auto bus = test_bus();
+    for (int frame = 0; frame < 120; frame++)
+        bus->execute_one_frame();
+
+    // the program's IRQ handler counts in $13; in four-step mode the frame counter raises one every 29830 cycles,
+    // a little less than a frame, and the NMI handler's RTI mustn't leave them masked
+    REQUIRE(bus->ram[0x13] >= 115);
+    REQUIRE(bus->ram[0x13] <= 120);
+    REQUIRE_FALSE(bus->cpu.status & I);
+}
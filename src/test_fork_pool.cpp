@@ -0,0 +1,87 @@
+#include <cstring>
+#include <vector>
+
+#include <catch2/catch_all.hpp>
+
+#include "fork_pool.h"
+#include "test_program.h"
+
+namespace {
+    constexpr int JOBS = 16;
+    constexpr int FRAMES = 30;
+
+    /// The test program run from power-on to the middle of its 21st frame.
+    std::unique_ptr<Bus> start_mid_frame() {
+        auto bus = test_bus(1);
+        for (int frame = 0; frame < 20; frame++)
+            run_test_frame(*bus, frame);
+        for (int i = 0; i < 5000; i++)
+            bus->execute_one_instruction();
+        return bus;
+    }
+
+    /// Different buttons for every job, on both controllers.
+    std::vector<uint16> job_input(int job) {
+        std::vector<uint16> input;
+        for (int frame = 0; frame < FRAMES; frame++)
+            input.push_back(test_input(frame * (job + 1)) | (job * 17 & 0xff) << 8);
+        return input;
+    }
+}
+
+TEST_CASE("forks run on a pool end up where serial runs do", "[fork]") {
+    std::unique_ptr<Bus> parent = start_mid_frame();
+    MachineState before;
+    parent->save_state(before);
+
+    std::vector<std::unique_ptr<Bus>> forks;
+    std::vector<ForkPool::Job> jobs;
+    for (int job = 0; job < JOBS; job++) {
+        forks.push_back(parent->fork());
+        jobs.push_back({forks.back().get(), job_input(job)});
+    }
+    ForkPool pool(4);
+    pool.run(jobs);
+
+    // the same history from power-on, and then each job's input, one after another on this thread
+    for (int job = 0; job < JOBS; job++) {
+        std::unique_ptr<Bus> serial = start_mid_frame();
+        for (uint16 pads : job_input(job)) {
+            serial->controller[0] = pads & 0xff;
+            serial->controller[1] = pads >> 8;
+            serial->execute_one_frame();
+        }
+        REQUIRE(jobs[job].state_hash == serial->state_hash());
+        REQUIRE(jobs[job].ram == serial->ram);
+    }
+    REQUIRE(jobs[0].state_hash != jobs[1].state_hash);
+
+    // the parent didn't move
+    MachineState after;
+    parent->save_state(after);
+    REQUIRE(std::memcmp(&before, &after, sizeof(MachineState)) == 0);
+}
+
+TEST_CASE("a fork writing to its cartridge gets a copy of its own", "[fork]") {
+    std::unique_ptr<Bus> parent = start_mid_frame();
+    std::unique_ptr<Bus> child = parent->fork();
+    const Cartridge &parent_cartridge = parent->cartridge;
+    const Cartridge &child_cartridge = child->cartridge;
+    REQUIRE(child_cartridge.prg.data() == parent_cartridge.prg.data());
+    REQUIRE(child_cartridge.chr.data() == parent_cartridge.chr.data());
+
+    // as a mapper with PRG or CHR RAM would
+    uint8 prg = parent_cartridge.prg[0x10], chr = parent_cartridge.chr[0x10];
+    child->cartridge.prg[0x10] = prg ^ 0xff;
+    child->cartridge.chr[0x10] = chr ^ 0xff;
+
+    REQUIRE(child_cartridge.prg.data() != parent_cartridge.prg.data());
+    REQUIRE(child_cartridge.chr.data() != parent_cartridge.chr.data());
+    REQUIRE(child_cartridge.prg[0x10] == (prg ^ 0xff));
+    REQUIRE(child_cartridge.chr[0x10] == (chr ^ 0xff));
+    REQUIRE(parent_cartridge.prg[0x10] == prg);
+    REQUIRE(parent_cartridge.chr[0x10] == chr);
+    // and the rest is the same
+    REQUIRE(std::memcmp(child_cartridge.prg.data() + 0x11, parent_cartridge.prg.data() + 0x11,
+                        parent_cartridge.prg.size() - 0x11) == 0);
+}
@@ -0,0 +1,96 @@
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+
+#include <catch2/catch_all.hpp>
+
+#include "movie.h"
+
+namespace {
+    Movie test_movie() {
+        Movie movie;
+        movie.rom_hash = 0x0123456789abcdef;
+        for (int frame = 0; frame < 5000; frame++)
+            movie.input.push_back(((frame / 7) * 37 & 0xff) | ((frame / 13) * 91 & 0xff) << 8);
+        // held for longer than one run can count
+        movie.input.insert(movie.input.end(), 70000, 0x0101);
+        movie.input.push_back(0xffff);
+        return movie;
+    }
+
+    /// Rewrites part of a file in place.
+    void patch(const char *path, long offset, const void *data, size_t size) {
+        FILE *file = fopen(path, "r+b");
+        REQUIRE(file);
+        fseek(file, offset, SEEK_SET);
+        fwrite(data, size, 1, file);
+        fclose(file);
+    }
+}
+
+TEST_CASE("movies come back the way they were written", "[movie]") {
+    Movie movie = test_movie();
+    Movie loaded;
+
+    SECTION("in our format") {
+        const char *path = "test_movie.nesm";
+        REQUIRE(movie::write(path, movie));
+        REQUIRE(movie::read(path, loaded));
+        std::remove(path);
+        REQUIRE(loaded.rom_hash == movie.rom_hash);
+        REQUIRE(loaded.input == movie.input);
+    }
+
+    SECTION("as FM2") {
+        const char *path = "test_movie.fm2";
+        REQUIRE(movie::write_fm2(path, movie, "test"));
+        REQUIRE(movie::read_fm2(path, loaded));
+        std::remove(path);
+        REQUIRE(loaded.rom_hash == 0); // FM2 has nowhere to keep it
+        REQUIRE(loaded.input == movie.input);
+    }
+
+    SECTION("with no frames") {
+        const char *path = "test_movie.nesm";
+        REQUIRE(movie::write(path, Movie()));
+        loaded.input.push_back(1);
+        REQUIRE(movie::read(path, loaded));
+        std::remove(path);
+        REQUIRE(loaded.input.empty());
+    }
+}
+
+TEST_CASE("corrupted movies are refused", "[movie]") {
+    const char *path = "test_movie.nesm";
+    Movie movie = test_movie();
+    REQUIRE(movie::write(path, movie));
+    Movie loaded;
+    loaded.input.push_back(1); // left alone when reading fails
+
+    SECTION("a run count the file doesn't hold") {
+        uint32 runs = 0x7fffffff;
+        patch(path, offsetof(movie::FileHeader, runs), &runs, sizeof(runs));
+        REQUIRE_FALSE(movie::read(path, loaded));
+    }
+
+    SECTION("a frame count the runs don't add up to") {
+        uint32 frames = 0xffffffff;
+        patch(path, offsetof(movie::FileHeader, frames), &frames, sizeof(frames));
+        REQUIRE_FALSE(movie::read(path, loaded));
+    }
+
+    SECTION("a run's length changed") {
+        movie::Run run = {0, 1000};
+        patch(path, sizeof(movie::FileHeader), &run, sizeof(run));
+        REQUIRE_FALSE(movie::read(path, loaded));
+    }
+
+    SECTION("another version") {
+        uint32 version = movie::VERSION + 1;
+        patch(path, offsetof(movie::FileHeader, version), &version, sizeof(version));
+        REQUIRE_FALSE(movie::read(path, loaded));
+    }
+
+    std::remove(path);
+    REQUIRE(loaded.input.size() == 1);
+}
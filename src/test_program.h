@@ -0,0 +1,154 @@
+#pragma once
+
+#include <iterator>
+#include <memory>
+#include <vector>
+
+#include "bus.h"
+
+/// A small NROM program for the tests that need a machine doing something, since no game comes with the repo. It
+/// keeps every APU channel busy, counts the frame IRQs in $13, reads controller 1 every frame and has the buttons
+/// change a pitch and a nametable byte, and churns through RAM in between.
+inline Cartridge test_program() {
+    static const uint8 program[] = {
+        // reset:
+        0x78,                    // SEI
+        0xd8,                    // CLD
+        0xa2, 0xff,              // LDX #$FF
+        0x9a,                    // TXS
+        0xa9, 0x1f,              // LDA #$1F   every channel on
+        0x8d, 0x15, 0x40,        // STA $4015
+        0xa9, 0xbf,              // LDA #$BF   pulse 1: constant volume 15, length halted
+        0x8d, 0x00, 0x40,        // STA $4000
+        0xa9, 0x7a,              // LDA #$7A   pulse 2: decaying envelope
+        0x8d, 0x04, 0x40,        // STA $4004
+        0xa9, 0x8a,              // LDA #$8A   pulse 2: sweeping down
+        0x8d, 0x05, 0x40,        // STA $4005
+        0xa9, 0xc0,              // LDA #$C0   triangle: linear counter held
+        0x8d, 0x08, 0x40,        // STA $4008
+        0xa9, 0x34,              // LDA #$34   noise: constant volume 4, length halted
+        0x8d, 0x0c, 0x40,        // STA $400C
+        0xa9, 0x4f,              // LDA #$4F   DMC: looping, fastest rate
+        0x8d, 0x10, 0x40,        // STA $4010
+        0xa9, 0x40,              // LDA #$40
+        0x8d, 0x11, 0x40,        // STA $4011
+        0xa9, 0x00,              // LDA #$00   the sample is this program, at $C000
+        0x8d, 0x12, 0x40,        // STA $4012
+        0xa9, 0x10,              // LDA #$10
+        0x8d, 0x13, 0x40,        // STA $4013
+        0xa9, 0x00,              // LDA #$00   frame counter: four steps, with IRQs
+        0x8d, 0x17, 0x40,        // STA $4017
+        0xa9, 0x80,              // LDA #$80   NMI on
+        0x8d, 0x00, 0x20,        // STA $2000
+        0xa9, 0x1e,              // LDA #$1E   background and sprites on
+        0x8d, 0x01, 0x20,        // STA $2001
+        0x58,                    // CLI
+        // loop:
+        0xe6, 0x10,              // INC $10
+        0xa6, 0x10,              // LDX $10
+        0x8a,                    // TXA
+        0x45, 0x11,              // EOR $11
+        0x9d, 0x00, 0x03,        // STA $0300,X
+        0x4c, 0x47, 0x80,        // JMP loop
+        // nmi:
+        0x48,                    // PHA
+        0x8a,                    // TXA
+        0x48,                    // PHA
+        0xe6, 0x11,              // INC $11
+        0xa9, 0x01,              // LDA #$01   controller 1 into $12
+        0x8d, 0x16, 0x40,        // STA $4016
+        0xa9, 0x00,              // LDA #$00
+        0x8d, 0x16, 0x40,        // STA $4016
+        0xa2, 0x08,              // LDX #$08
+        // read:
+        0xad, 0x16, 0x40,        // LDA $4016
+        0x4a,                    // LSR A
+        0x26, 0x12,              // ROL $12
+        0xca,                    // DEX
+        0xd0, 0xf7,              // BNE read
+        0xa5, 0x11,              // LDA $11   pitches follow the frame count and the buttons
+        0x8d, 0x02, 0x40,        // STA $4002
+        0xa9, 0x08,              // LDA #$08
+        0x8d, 0x03, 0x40,        // STA $4003
+        0xa5, 0x12,              // LDA $12
+        0x09, 0x20,              // ORA #$20
+        0x8d, 0x06, 0x40,        // STA $4006
+        0xa9, 0x01,              // LDA #$01
+        0x8d, 0x07, 0x40,        // STA $4007
+        0xa5, 0x11,              // LDA $11
+        0x0a,                    // ASL A
+        0x8d, 0x0a, 0x40,        // STA $400A
+        0xa9, 0x08,              // LDA #$08
+        0x8d, 0x0b, 0x40,        // STA $400B
+        0xa5, 0x11,              // LDA $11
+        0x29, 0x0f,              // AND #$0F
+        0x8d, 0x0e, 0x40,        // STA $400E
+        0xa9, 0x08,              // LDA #$08
+        0x8d, 0x0f, 0x40,        // STA $400F
+        0xad, 0x02, 0x20,        // LDA $2002   a nametable byte per frame
+        0xa9, 0x20,              // LDA #$20
+        0x8d, 0x06, 0x20,        // STA $2006
+        0xa5, 0x11,              // LDA $11
+        0x8d, 0x06, 0x20,        // STA $2006
+        0xa5, 0x12,              // LDA $12
+        0x8d, 0x07, 0x20,        // STA $2007
+        0xa9, 0x00,              // LDA #$00
+        0x8d, 0x05, 0x20,        // STA $2005
+        0x8d, 0x05, 0x20,        // STA $2005
+        0x68,                    // PLA
+        0xaa,                    // TAX
+        0x68,                    // PLA
+        0x40,                    // RTI
+        // irq:
+        0x48,                    // PHA
+        0xad, 0x15, 0x40,        // LDA $4015   acknowledges the frame IRQ
+        0xe6, 0x13,              // INC $13
+        0x68,                    // PLA
+        0x40,                    // RTI
+    };
+
+    Cartridge cartridge(1, 1, std::make_unique<Mapper00NROM>(1, 1));
+    for (size_t i = 0; i < std::size(program); i++)
+        cartridge.prg[i] = program[i];
+    // the vectors at $fffa, in the mirror of the 16 KiB bank
+    const uint16 vectors[] = {0x8054, 0x8000, 0x80b9}; // NMI, reset, IRQ
+    for (size_t i = 0; i < std::size(vectors); i++) {
+        cartridge.prg[0x3ffa + 2 * i] = vectors[i] & 0xff;
+        cartridge.prg[0x3ffb + 2 * i] = vectors[i] >> 8;
+    }
+    return cartridge;
+}
+
+/// Buttons for controller 1 that change every few frames, in the low byte like Movie::input.
+inline uint16 test_input(int frame) {
+    return static_cast<uint16>((frame / 7) * 37 & 0xff);
+}
+
+/// The test program's machine, reset and ready to run.
+inline std::unique_ptr<Bus> test_bus(int render_interval = 0) {
+    auto bus = std::make_unique<Bus>(test_program());
+    bus->reset();
+    bus->ppu.render_interval = render_interval;
+    return bus;
+}
+
+/// Runs frame number `frame` with its test_input.
+inline void run_test_frame(Bus &bus, int frame) {
+    bus.controller[0] = test_input(frame) & 0xff;
+    bus.execute_one_frame();
+}
+
+/// The state before (the way the emulation thread takes them for rewinding) or after each of the test program's
+/// first `frames` frames.
+inline std::vector<MachineState> record_states(int frames, bool before_frame) {
+    auto bus = test_bus();
+    std::vector<MachineState> states(frames);
+    for (int frame = 0; frame < frames; frame++) {
+        if (before_frame)
+            bus->save_state(states[frame]);
+        run_test_frame(*bus, frame);
+        if (!before_frame)
+            bus->save_state(states[frame]);
+    }
+    return states;
+}
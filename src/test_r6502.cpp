@@ -18,6 +18,8 @@ class TestMapper : public Mapper {
 public:
     TestMapper() : Mapper(1, 1) {}
 
+    std::unique_ptr<Mapper> clone() const override { return std::make_unique<TestMapper>(*this); }
+
     std::optional<uint32> map_cpu_read(uint16 addr) override {
         if (addr >= 0xF000) {
             return addr & 0xfff;
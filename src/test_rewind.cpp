@@ -0,0 +1,72 @@
+#include <cstring>
+#include <vector>
+
+#include <catch2/catch_all.hpp>
+
+#include "rewind.h"
+#include "test_program.h"
+
+TEST_CASE("rewinding gives back every state pushed, newest first", "[rewind]") {
+    constexpr int FRAMES = 3600; // a minute
+    std::vector<MachineState> states = record_states(FRAMES, true);
+
+    SECTION("all of them, within the budget") {
+        Rewind rewind(64 * 1024 * 1024, 60, false);
+        for (const MachineState &state : states)
+            rewind.push(state);
+
+        Rewind::Stats stats = rewind.stats();
+        REQUIRE(stats.frames == FRAMES);
+        REQUIRE(stats.dropped == 0);
+        // keyframes a second apart and run-length coded deltas in between, instead of whole states
+        CHECK(stats.bytes < FRAMES * sizeof(MachineState) / 8);
+
+        MachineState state;
+        for (int frame = FRAMES - 1; frame >= 0; frame--) {
+            REQUIRE(rewind.pop(state));
+            REQUIRE(std::memcmp(&state, &states[frame], sizeof(MachineState)) == 0);
+        }
+        REQUIRE_FALSE(rewind.pop(state));
+        REQUIRE(rewind.stats().frames == 0);
+    }
+
+    SECTION("only the newest, once the budget is used up") {
+        Rewind rewind(256 * 1024, 60, false);
+        for (const MachineState &state : states)
+            rewind.push(state);
+
+        Rewind::Stats stats = rewind.stats();
+        REQUIRE(stats.bytes <= 256 * 1024);
+        REQUIRE(stats.frames > 0);
+        REQUIRE(stats.frames < FRAMES);
+
+        MachineState state;
+        for (size_t i = 0; i < stats.frames; i++) {
+            REQUIRE(rewind.pop(state));
+            REQUIRE(std::memcmp(&state, &states[FRAMES - 1 - i], sizeof(MachineState)) == 0);
+        }
+        REQUIRE_FALSE(rewind.pop(state));
+    }
+
+    SECTION("pushing again after popping") {
+        Rewind rewind(64 * 1024 * 1024, 60, false);
+        for (int frame = 0; frame < 1000; frame++)
+            rewind.push(states[frame]);
+        MachineState state;
+        for (int frame = 999; frame >= 500; frame--)
+            REQUIRE(rewind.pop(state));
+
+        // going on from frame 500 as the emulation thread does once rewinding stops, with a different future
+        for (int frame = 2000; frame < 2100; frame++)
+            rewind.push(states[frame]);
+        for (int frame = 2099; frame >= 2000; frame--) {
+            REQUIRE(rewind.pop(state));
+            REQUIRE(std::memcmp(&state, &states[frame], sizeof(MachineState)) == 0);
+        }
+        for (int frame = 499; frame >= 0; frame--) {
+            REQUIRE(rewind.pop(state));
+            REQUIRE(std::memcmp(&state, &states[frame], sizeof(MachineState)) == 0);
+        }
+        REQUIRE_FALSE(rewind.pop(state));
+    }
+}
@@ -0,0 +1,57 @@
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include <catch2/catch_all.hpp>
+
+#include "hash.h"
+#include "save_state.h"
+#include "test_program.h"
+
+namespace {
+    /// The state and picture after each of `frames` frames, fed the test input from `first_frame` on.
+    std::vector<uint64> replay(Bus &bus, int first_frame, int frames) {
+        std::vector<uint64> hashes;
+        for (int frame = first_frame; frame < first_frame + frames; frame++) {
+            run_test_frame(bus, frame);
+            uint64 picture = fnv1a(bus.ppu.frame_buffer(), SCREEN_WIDTH * SCREEN_HEIGHT);
+            hashes.push_back(bus.state_hash() ^ picture);
+        }
+        return hashes;
+    }
+}
+
+TEST_CASE("a loaded state replays exactly like the machine it was saved from", "[save_state]") {
+    auto bus = test_bus(1);
+    bus->apu.set_sample_rate(44100);
+    replay(*bus, 0, 100);
+
+    MachineState state;
+    bus->save_state(state);
+    std::vector<uint64> expected = replay(*bus, 100, 200);
+
+    SECTION("into the same bus, after it ran on") {
+        bus->load_state(state);
+        REQUIRE(replay(*bus, 100, 200) == expected);
+    }
+
+    SECTION("into a bus that never ran") {
+        Bus other(test_program());
+        other.ppu.render_interval = 1;
+        other.apu.set_sample_rate(44100);
+        other.load_state(state);
+        REQUIRE(replay(other, 100, 200) == expected);
+    }
+
+    SECTION("through a file") {
+        const char *path = "test_save_state.nss";
+        REQUIRE(save_state::write(path, state, bus->cartridge.rom_hash()));
+        MachineState loaded;
+        REQUIRE(save_state::read(path, loaded, bus->cartridge.rom_hash()));
+        std::remove(path);
+        REQUIRE(std::memcmp(&loaded, &state, sizeof(state)) == 0);
+
+        bus->load_state(loaded);
+        REQUIRE(replay(*bus, 100, 200) == expected);
+    }
+}
@@ -0,0 +1,70 @@
+#include <cstring>
+#include <vector>
+
+#include <catch2/catch_all.hpp>
+
+#include "state_store.h"
+#include "test_program.h"
+
+TEST_CASE("a state store gives back what was put in, and shares pages between states", "[state_store]") {
+    constexpr int FRAMES = 600;
+    std::vector<MachineState> states = record_states(FRAMES, false);
+    StateStore store;
+    MachineState state;
+
+    std::vector<StateStore::Id> ids;
+    for (const MachineState &put : states)
+        ids.push_back(store.put(put));
+    for (int i = 0; i < FRAMES; i++) {
+        store.get(ids[i], state);
+        REQUIRE(std::memcmp(&state, &states[i], sizeof(MachineState)) == 0);
+    }
+
+    StateStore::Stats stats = store.stats();
+    REQUIRE(stats.states == FRAMES);
+    REQUIRE(stats.logical_bytes == FRAMES * sizeof(MachineState));
+    // most of the machine stays the same from one frame to the next
+    CHECK(stats.dedup_ratio > 2);
+    CHECK(stats.resident_bytes < stats.logical_bytes);
+
+    SECTION("the same state twice takes no new pages") {
+        size_t pages = stats.pages;
+        StateStore::Id again = store.put(states[0]);
+        REQUIRE(store.stats().pages == pages);
+        store.get(again, state);
+        REQUIRE(std::memcmp(&state, &states[0], sizeof(MachineState)) == 0);
+    }
+
+    SECTION("released states' ids and pages are reused") {
+        for (int i = 0; i < FRAMES; i += 2)
+            store.release(ids[i]);
+        REQUIRE(store.stats().states == FRAMES / 2);
+        REQUIRE(store.stats().pages < stats.pages);
+
+        // back in reverse, so the ids handed out again don't line up with the frames they held before
+        for (int i = FRAMES - 2; i >= 0; i -= 2) {
+            StateStore::Id id = store.put(states[FRAMES - 2 - i]);
+            REQUIRE(id < FRAMES);
+            ids[i] = id;
+        }
+        REQUIRE(store.stats().states == FRAMES);
+        REQUIRE(store.stats().pages == stats.pages);
+
+        for (int i = 0; i < FRAMES; i++) {
+            store.get(ids[i], state);
+            REQUIRE(std::memcmp(&state, &states[i % 2 ? i : FRAMES - 2 - i], sizeof(MachineState)) == 0);
+        }
+    }
+
+    SECTION("releasing every state frees every page") {
+        for (StateStore::Id id : ids)
+            store.release(id);
+        REQUIRE(store.stats().states == 0);
+        REQUIRE(store.stats().pages == 0);
+
+        StateStore::Id id = store.put(states[FRAMES - 1]);
+        REQUIRE(id < FRAMES);
+        store.get(id, state);
+        REQUIRE(std::memcmp(&state, &states[FRAMES - 1], sizeof(MachineState)) == 0);
+    }
+}
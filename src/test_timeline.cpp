@@ -0,0 +1,74 @@
+#include <vector>
+
+#include <catch2/catch_all.hpp>
+
+#include "test_program.h"
+#include "timeline.h"
+
+namespace {
+    // an eighth of a frame, so stepping back a few thousand instructions crosses plenty of keyframes
+    constexpr uint64 KEYFRAME_INTERVAL = 341 * 262 / 8;
+    constexpr size_t KEYFRAMES = 1000;
+    constexpr int INSTRUCTIONS = 30000; // three frames or so, with their NMIs
+
+    /// Runs the test program an instruction at a time, recording each on `timeline` the way the debugger does, and
+    /// with the buttons changing every few thousand instructions.
+    void run_instructions(Bus &bus, Timeline &timeline, int count, std::vector<uint64> *hashes = nullptr) {
+        for (int i = 0; i < count; i++) {
+            bus.controller[0] = test_input(i / 4000) & 0xff;
+            timeline.record(bus);
+            bus.execute_one_instruction();
+            if (hashes)
+                hashes->push_back(bus.state_hash());
+        }
+    }
+}
+
+TEST_CASE("the timeline steps and continues back to where the bus was", "[timeline]") {
+    std::unique_ptr<Bus> machine = test_bus();
+    Bus &bus = *machine;
+    Timeline timeline(KEYFRAME_INTERVAL, KEYFRAMES);
+
+    SECTION("each step back undoes one instruction") {
+        std::vector<uint64> hashes; // the state after every instruction
+        run_instructions(bus, timeline, INSTRUCTIONS, &hashes);
+
+        for (int i = INSTRUCTIONS - 1; i > INSTRUCTIONS - 3000; i--) {
+            REQUIRE(timeline.step_back(bus));
+            REQUIRE(bus.state_hash() == hashes[i - 1]);
+        }
+
+        // and going forward again from there makes a new history
+        run_instructions(bus, timeline, 1);
+        REQUIRE(timeline.step_back(bus));
+        REQUIRE(bus.state_hash() == hashes[INSTRUCTIONS - 3000]);
+    }
+
+    SECTION("continuing back stops at the last breakpoint before the present") {
+        // the NMI handler writes PPUADDR twice a frame; probing notes every clock one is reached on, without stopping
+        bus.cpu.address_write_breakpoints.push_back(0x2006);
+        std::vector<uint64> hits;
+        for (int i = 0; i < INSTRUCTIONS; i++) {
+            bus.breakpoints_enabled = true;
+            bus.probing_breakpoints = true;
+            bus.last_breakpoint_clock = UINT64_MAX;
+            bus.controller[0] = test_input(i / 4000) & 0xff;
+            timeline.record(bus);
+            bus.execute_one_instruction();
+            if (bus.last_breakpoint_clock != UINT64_MAX)
+                hits.push_back(bus.last_breakpoint_clock);
+        }
+        bus.breakpoints_enabled = false;
+        bus.probing_breakpoints = false;
+        REQUIRE(hits.size() >= 4);
+
+        for (size_t i = hits.size(); i-- > 0;) {
+            REQUIRE(timeline.continue_back(bus));
+            REQUIRE(bus.system_clock == hits[i]);
+        }
+        // there's none before the first
+        uint64 first = bus.system_clock;
+        REQUIRE_FALSE(timeline.continue_back(bus));
+        REQUIRE(bus.system_clock == first);
+    }
+}
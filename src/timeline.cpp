@@ -0,0 +1,181 @@
+#include "timeline.h"
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+
+namespace {
+    /// Whether the clock about to run starts (and, in this CPU, executes) an instruction.
+    bool starts_instruction(const Bus &bus) {
+        return bus.system_clock % 3 == 0 && bus.dma_cycles == 0 && bus.cpu.cycles == 0;
+    }
+}
+
+Timeline::Timeline(uint64 keyframe_interval, size_t max_keyframes)
+        : keyframe_interval(keyframe_interval), max_keyframes(max_keyframes) {
+    ASSERT(keyframe_interval > 0 && max_keyframes > 0, "interval %llu, %zu keyframes",
+           (unsigned long long) keyframe_interval, max_keyframes);
+}
+
+void Timeline::record(const Bus &bus) {
+    // after stepping back the bus is behind what was recorded, and makes a new history from here
+    truncate(bus.system_clock);
+    if (keyframes.empty() || bus.system_clock >= keyframes.back().clock + keyframe_interval) {
+        take_keyframe(bus, false);
+        return;
+    }
+
+    const uint8 *controller = !inputs.empty() && inputs.back().clock >= keyframes.back().clock
+                              ? inputs.back().controller : keyframes.back().controller;
+    if (controller[0] != bus.controller[0] || controller[1] != bus.controller[1])
+        inputs.push_back({bus.system_clock, {bus.controller[0], bus.controller[1]}});
+}
+
+void Timeline::record_interruption(const Bus &bus) {
+    truncate(bus.system_clock);
+    take_keyframe(bus, true);
+}
+
+void Timeline::clear() {
+    keyframes.clear();
+    inputs.clear();
+}
+
+void Timeline::take_keyframe(const Bus &bus, bool interrupted) {
+    Keyframe &keyframe = keyframes.emplace_back();
+    keyframe.clock = bus.system_clock;
+    keyframe.interrupted = interrupted;
+    keyframe.controller[0] = bus.controller[0];
+    keyframe.controller[1] = bus.controller[1];
+    bus.save_state(keyframe.state);
+
+    if (keyframes.size() > max_keyframes) {
+        keyframes.pop_front();
+        // a replay starts with its keyframe's controllers, so older changes are never needed again
+        while (!inputs.empty() && inputs.front().clock < keyframes.front().clock)
+            inputs.pop_front();
+    }
+}
+
+void Timeline::truncate(uint64 clock) {
+    while (!keyframes.empty() && keyframes.back().clock > clock)
+        keyframes.pop_back();
+    while (!inputs.empty() && inputs.back().clock >= clock)
+        inputs.pop_back();
+}
+
+size_t Timeline::keyframe_before(uint64 clock) const {
+    for (size_t i = keyframes.size(); i-- > 0;) {
+        if (keyframes[i].clock < clock)
+            return i;
+    }
+    return SIZE_MAX;
+}
+
+template<typename F>
+void Timeline::replay(Bus &bus, size_t index, uint64 clock, F before_clock) const {
+    const Keyframe &keyframe = keyframes[index];
+    bus.load_state(keyframe.state);
+    bus.controller[0] = keyframe.controller[0];
+    bus.controller[1] = keyframe.controller[1];
+
+    auto input = std::lower_bound(inputs.begin(), inputs.end(), keyframe.clock,
+                                  [](const InputChange &change, uint64 clock) { return change.clock < clock; });
+    for (;;) {
+        for (; input != inputs.end() && input->clock <= bus.system_clock; ++input) {
+            bus.controller[0] = input->controller[0];
+            bus.controller[1] = input->controller[1];
+        }
+        if (bus.system_clock >= clock)
+            break;
+        before_clock(bus);
+        bus.clock();
+    }
+}
+
+bool Timeline::step_back(Bus &bus) {
+    auto start = std::chrono::steady_clock::now();
+    defer { last_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count(); };
+    ReplaySettings settings(bus);
+    uint64 present = bus.system_clock;
+    // stopped on a breakpoint, the bus is in the middle of the present clock, so being right before it is going back
+    bool interrupted = !keyframes.empty() && keyframes.back().interrupted && keyframes.back().clock == present;
+    uint64 limit = interrupted ? present + 1 : present;
+    // the present can't be re-run to if it's in the middle of a clock, so it's kept aside in case history ends
+    auto saved = std::make_unique<MachineState>();
+    bus.save_state(*saved);
+
+    // newest keyframe first, the first stretch with an instruction in it has the last one
+    uint64 end = present;
+    for (size_t i = keyframe_before(limit); i != SIZE_MAX; end = keyframes[i--].clock) {
+        uint64 last_start = UINT64_MAX;
+        replay(bus, i, std::min(end, limit - 1), [&](const Bus &replaying) {
+            if (starts_instruction(replaying))
+                last_start = replaying.system_clock;
+        });
+        if (last_start != UINT64_MAX) {
+            replay(bus, i, last_start + 1, [](const Bus &) {});
+            truncate(bus.system_clock);
+            return true;
+        }
+    }
+
+    bus.load_state(*saved);
+    return false;
+}
+
+bool Timeline::continue_back(Bus &bus) {
+    auto start = std::chrono::steady_clock::now();
+    defer { last_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count(); };
+    ReplaySettings settings(bus);
+    uint64 present = bus.system_clock;
+    auto saved = std::make_unique<MachineState>();
+    bus.save_state(*saved);
+
+    // newest keyframe first, the first stretch that reaches a breakpoint has the last one; the clock the bus may be
+    // stopped in right now isn't run again, so it doesn't find itself
+    uint64 end = present;
+    for (size_t i = keyframe_before(present); i != SIZE_MAX; end = keyframes[i--].clock) {
+        bus.breakpoints_enabled = true;
+        bus.probing_breakpoints = true;
+        bus.last_breakpoint_clock = UINT64_MAX;
+        replay(bus, i, end, [](const Bus &) {});
+        bus.breakpoints_enabled = false;
+        bus.probing_breakpoints = false;
+
+        uint64 clock = bus.last_breakpoint_clock;
+        if (clock == UINT64_MAX)
+            continue;
+        // the keyframe is where the bus stopped on it before
+        if (keyframes[i].interrupted && keyframes[i].clock == clock) {
+            replay(bus, i, clock, [](const Bus &) {});
+            truncate(clock);
+            return true;
+        }
+
+        replay(bus, i, clock, [](const Bus &) {});
+        bool stopped = false;
+        bus.breakpoints_enabled = true;
+        try {
+            bus.clock();
+        } catch (const BreakpointException &e) {
+            stopped = true;
+        }
+        bus.breakpoints_enabled = false;
+        ASSERT(stopped, "a breakpoint found at clock %llu didn't stop the bus there", (unsigned long long) clock);
+        record_interruption(bus);
+        return true;
+    }
+
+    bus.load_state(*saved);
+    return false;
+}
+
+Timeline::Stats Timeline::stats() const {
+    Stats stats;
+    stats.keyframes = keyframes.size();
+    if (!keyframes.empty())
+        stats.seconds = (keyframes.back().clock - keyframes.front().clock) / (3 * CPU_CLOCK_RATE);
+    stats.last_ms = last_ms;
+    return stats;
+}
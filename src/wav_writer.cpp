@@ -0,0 +1,88 @@
+#include "wav_writer.h"
+
+#include <cstring>
+
+WavWriter::WavWriter(const char *path, int sample_rate) : sample_rate(sample_rate), ring(RING_CAPACITY) {
+    file = fopen(path, "wb");
+    if (!file) {
+        LOG_WARN("could not open %s for writing", path);
+        return;
+    }
+
+    write_header(0);
+    worker = std::thread(&WavWriter::run, this);
+}
+
+WavWriter::~WavWriter() {
+    if (!file)
+        return;
+
+    running.store(false, std::memory_order_release);
+    worker.join();
+    fclose(file);
+}
+
+void WavWriter::push(const int16 *samples, int count) {
+    if (!file)
+        return;
+
+    size_t pushed = ring.push(samples, count);
+    if (pushed < static_cast<size_t>(count))
+        dropped += count - pushed;
+}
+
+void WavWriter::run() {
+    constexpr size_t CHUNK = 4096;
+    int16 chunk[CHUNK];
+    uint64 header_samples = 0;
+
+    for (;;) {
+        // checked before draining, so everything pushed before the destructor ran still makes it into the file
+        bool stopping = !running.load(std::memory_order_acquire);
+
+        size_t count;
+        while ((count = ring.pop(chunk, CHUNK)) > 0) {
+            size_t written = fwrite(chunk, sizeof(int16), count, file);
+            samples_written += written;
+            dropped += count - written;
+        }
+
+        if (stopping)
+            break;
+        if (samples_written - header_samples >= static_cast<uint64>(sample_rate)) {
+            header_samples = samples_written;
+            write_header(header_samples);
+        }
+        std::this_thread::sleep_for(WAKE_INTERVAL);
+    }
+
+    write_header(samples_written);
+}
+
+void WavWriter::write_header(uint64 samples) {
+    // http://soundfile.sapp.org/doc/WaveFormat/
+    // the sizes are 32 bits; past 4 GiB (over 12 hours at 48 kHz) players have to go by the file's size instead
+    auto data_size = static_cast<uint32>(std::min<uint64>(samples * sizeof(int16), UINT32_MAX - 36));
+
+    uint8 header[44];
+    auto put = [&](int at, uint32 value, int bytes) {
+        for (int i = 0; i < bytes; i++)
+            header[at + i] = static_cast<uint8>(value >> (8 * i)); // little endian
+    };
+    std::memcpy(header, "RIFF", 4);
+    put(4, 36 + data_size, 4);
+    std::memcpy(header + 8, "WAVEfmt ", 8);
+    put(16, 16, 4); // size of the fmt chunk
+    put(20, 1, 2);  // PCM
+    put(22, 1, 2);  // channels
+    put(24, sample_rate, 4);
+    put(28, sample_rate * sizeof(int16), 4);
+    put(32, sizeof(int16), 2);
+    put(34, 16, 2); // bits per sample
+    std::memcpy(header + 36, "data", 4);
+    put(40, data_size, 4);
+
+    fseek(file, 0, SEEK_SET);
+    fwrite(header, 1, sizeof(header), file);
+    fseek(file, 0, SEEK_END);
+}